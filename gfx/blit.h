@@ -4,6 +4,7 @@ void GFXCLASS::blitRect(uint16_t x_src, uint16_t y_src, uint16_t x_dst,
 #ifdef PROFILE_BLIT
   uint32_t s = micros();
 #endif
+  int damage_y = y_dst, damage_h = height;
   if (y_dst == y_src && x_dst > x_src) {
     while (height) {
       memmove(&pixelText(x_dst, y_dst), &pixelText(x_src, y_src),
@@ -36,6 +37,7 @@ void GFXCLASS::blitRect(uint16_t x_src, uint16_t y_src, uint16_t x_dst,
   if (e - s > 1000)
     printf("blit %d us\n", e - s);
 #endif
+  damageText(damage_y, damage_h);
   cleanCache();
 }
 
@@ -50,6 +52,7 @@ void GFXCLASS::blitRect(uint16_t x_src, uint16_t y_src, uint16_t x_dst,
 
 void GFXCLASS::blitRectAlpha(uint16_t x_src, uint16_t y_src, uint16_t x_dst,
                              uint16_t y_dst, uint16_t width, uint16_t height) {
+  int damage_y = y_dst, damage_h = height;
   if (y_dst == y_src && x_dst > x_src) {
     while (height) {
       // XXX: implement this correctly
@@ -75,5 +78,6 @@ void GFXCLASS::blitRectAlpha(uint16_t x_src, uint16_t y_src, uint16_t x_dst,
       height--;
     }
   }
+  damageText(damage_y, damage_h);
   cleanCache();
 }
@@ -1,25 +1,79 @@
-void GFXCLASS::drawBg(bg_t *bg) {
+// Returns the alpha class of w x h pixels, pitch given in pixels.
+static int alpha_class(const pixel_t *p, int pitch, int w, int h) {
+  pixel_t all = (pixel_t)-1;
+  pixel_t any = 0;
+  for (int y = 0; y < h; ++y, p += pitch) {
+    for (int x = 0; x < w; ++x) {
+      all &= p[x];
+      any |= p[x];
+    }
+  }
+  if ((all >> 24) == 0xff)
+    return ALPHA_OPAQUE;
+  if ((any >> 24) == 0)
+    return ALPHA_TRANSPARENT;
+  return ALPHA_MIXED;
+}
+
+// Draws w x h foreground pixels of alpha class cls over the background,
+// pitches given in pixels. Opaque pixels replace the color of the
+// background but, like blending, keep its alpha channel.
+static void draw_alpha_block(int cls, pixel_t *dst, int dst_pitch,
+                             const pixel_t *src, int src_pitch, int w, int h) {
+  switch (cls) {
+  case ALPHA_TRANSPARENT:
+    break;
+  case ALPHA_OPAQUE:
+    for (int y = 0; y < h; ++y, dst += dst_pitch, src += src_pitch) {
+      for (int x = 0; x < w; ++x)
+        dst[x] = (src[x] & 0x00ffffff) | (dst[x] & 0xff000000);
+    }
+    break;
+  default:
+    overlay_alpha_stride_div255_round_approx(
+            (uint8_t *)dst, (const uint8_t *)src, (uint8_t *)dst,
+            dst_pitch, h, w, src_pitch);
+    break;
+  }
+}
 
+// Drops the tile classes of BGs whose patterns may have changed. Done
+// before composing so that bands composed concurrently do not have to.
+void GFXCLASS::prepareBgs() {
+  uint32_t gen = m_pattern_gen;
+  for (int b = 0; b < MAX_BG; ++b) {
+    bg_t *bg = &m_bg[b];
+    if (bg->enabled && bg->tile_class_gen != gen) {
+      memset(bg->tile_class, ALPHA_UNKNOWN, sizeof(bg->tile_class));
+      bg->tile_class_gen = gen;
+    }
+  }
+}
+
+// Draws the part of a BG that lies within clip.
+void GFXCLASS::drawBg(bg_t *bg, const Rect &clip) {
   int tile_size_x = bg->tile_size_x;
   int tile_size_y = bg->tile_size_y;
-  int ypoff = bg->scroll_y % tile_size_y;
 
-  // start/end coordinates of the visible BG window, relative to the
-  // BG's origin, in pixels
-  int start_x = bg->scroll_x;
-  int start_y = bg->scroll_y;
+  // visible part of the BG window, in screen coordinates
+  int clip_x0 = _max((int)bg->win_x, clip.x);
+  int clip_y0 = _max((int)bg->win_y, clip.y);
+  int clip_x1 = _min((int)(bg->win_x + bg->win_w), clip.x + clip.width);
+  int clip_y1 = _min((int)(bg->win_y + bg->win_h), clip.y + clip.height);
+  if (clip_x0 >= clip_x1 || clip_y0 >= clip_y1)
+    return;
 
   // offset to add to BG-relative coordinates to get screen coordinates
-  int offset_window_x = -start_x + bg->win_x;
-  int offset_window_y = -start_y + bg->win_y;
+  int offset_window_x = -bg->scroll_x + bg->win_x;
+  int offset_window_y = -bg->scroll_y + bg->win_y;
 
   int tile_start_x, tile_start_y;
   int tile_end_x, tile_end_y;
 
-  tile_start_y = bg->scroll_y / tile_size_y;
-  tile_end_y = tile_start_y + (bg->win_h + ypoff) / tile_size_y + 1;
-  tile_start_x = bg->scroll_x / bg->tile_size_x;
-  tile_end_x = tile_start_x + (bg->win_w + tile_size_x - 1) / tile_size_x + 1;
+  tile_start_y = (clip_y0 - offset_window_y) / tile_size_y;
+  tile_end_y = (clip_y1 - 1 - offset_window_y) / tile_size_y + 1;
+  tile_start_x = (clip_x0 - offset_window_x) / tile_size_x;
+  tile_end_x = (clip_x1 - 1 - offset_window_x) / tile_size_x + 1;
 
   for (int y = tile_start_y; y < tile_end_y; ++y) {
     for (int x = tile_start_x; x < tile_end_x; ++x) {
@@ -34,104 +88,209 @@ void GFXCLASS::drawBg(bg_t *bg) {
       int blit_height = tile_size_y;
 
       // clip width, height and adjust source and destination if the tile
-      // crosses the BG window limits
-      if (dst_y < bg->win_y) {
-        tile_y -= dst_y - bg->win_y;
-        blit_height += dst_y - bg->win_y;
-        dst_y = bg->win_y;
-      } else if (dst_y + blit_height >= bg->win_y + bg->win_h)
-        blit_height = bg->win_y + bg->win_h - dst_y;
-
-      if (dst_x < bg->win_x) {
-        tile_x -= dst_x - bg->win_x;
-        blit_width += dst_x - bg->win_x;
-        dst_x = bg->win_x;
-      } else if (dst_x + blit_width >= bg->win_x + bg->win_w)
-        blit_width = bg->win_x + bg->win_w - dst_x;
+      // crosses the limits of the visible part of the window
+      if (dst_y < clip_y0) {
+        tile_y += clip_y0 - dst_y;
+        blit_height -= clip_y0 - dst_y;
+        dst_y = clip_y0;
+      }
+      if (dst_y + blit_height > clip_y1)
+        blit_height = clip_y1 - dst_y;
+
+      if (dst_x < clip_x0) {
+        tile_x += clip_x0 - dst_x;
+        blit_width -= clip_x0 - dst_x;
+        dst_x = clip_x0;
+      }
+      if (dst_x + blit_width > clip_x1)
+        blit_width = clip_x1 - dst_x;
 
       if (blit_width <= 0 || blit_height <= 0)
         continue;
 
-      overlay_alpha_stride_div255_round_approx(
-              (uint8_t *)&pixelComp(dst_x, dst_y),
-              (uint8_t *)&pixelText(tile_x, tile_y),
-              (uint8_t *)&pixelComp(dst_x, dst_y),
-              compositePitch(), blit_height,
-              blit_width, offscreenPitch());
+      // Patterns in the visible part of the text layer change too often
+      // to be worth classifying.
+      int cls = ALPHA_MIXED;
+      if (bg->pat_y >= m_current_mode.y) {
+        cls = bg->tile_class[tile];
+        if (cls == ALPHA_UNKNOWN) {
+          cls = alpha_class(&pixelText(bg->pat_x + (tile % bg->pat_w) * tile_size_x,
+                                       bg->pat_y + (tile / bg->pat_w) * tile_size_y),
+                            offscreenPitch(), tile_size_x, tile_size_y);
+          bg->tile_class[tile] = cls;
+        }
+      }
+
+      draw_alpha_block(cls, &pixelComp(dst_x, dst_y), compositePitch(),
+                       &pixelText(tile_x, tile_y), offscreenPitch(),
+                       blit_width, blit_height);
     }
   }
 }
 
-void GFXCLASS::drawSprite(sprite_t *s) {
-  LOCK_SPRITES
-  if (s->pos_x + (int)s->p.w < 0 || s->pos_x >= width() ||
-      s->pos_y + (int)s->p.h < 0 || s->pos_y >= height()) {
-    UNLOCK_SPRITES
-    return;
-  }
+static inline bool sprite_offscreen(int x, int y, int w, int h,
+                                    int screen_w, int screen_h) {
+  return x + w < 0 || x >= screen_w || y + h < 0 || y >= screen_h;
+}
 
+// Builds the surface of a sprite from its pattern. Must be called with
+// the sprites locked.
+void GFXCLASS::loadSprite(sprite_t *s) {
   // sprite pattern start coordinates
   int px = s->p.pat_x + s->p.frame_x * s->p.w;
   int py = s->p.pat_y + s->p.frame_y * s->p.h;
 
-  if (s->must_reload || !s->surf) {
-    // XXX: do this asynchronously
-    if (s->surf)
-      delete s->surf;
-
-    // XXX: shouldn't this happen on the rotozoom surface?
-    pixel_t alpha = s->alpha << 24;
-    if (s->p.key != 0) {
-      for (int y = 0; y < s->p.h; ++y) {
-        for (int x = 0; x < s->p.w; ++x) {
-          if ((pixelText(px + x, py + y) & 0xffffff) == (s->p.key & 0xffffff)) {
-            pixelText(px + x, py + y) = pixelText(px + x, py + y) & 0xffffff;
-          } else
-            pixelText(px + x, py + y) =
-                    (pixelText(px + x, py + y) & 0xffffff) | alpha;
-        }
+  // XXX: do this asynchronously
+  if (s->surf)
+    delete s->surf;
+
+  // XXX: shouldn't this happen on the rotozoom surface?
+  pixel_t alpha = s->alpha << 24;
+  if (s->p.key != 0) {
+    bool changed = false;
+    for (int y = 0; y < s->p.h; ++y) {
+      for (int x = 0; x < s->p.w; ++x) {
+        pixel_t old = pixelText(px + x, py + y);
+        if ((pixelText(px + x, py + y) & 0xffffff) == (s->p.key & 0xffffff)) {
+          pixelText(px + x, py + y) = pixelText(px + x, py + y) & 0xffffff;
+        } else
+          pixelText(px + x, py + y) =
+                  (pixelText(px + x, py + y) & 0xffffff) | alpha;
+        changed = changed || pixelText(px + x, py + y) != old;
       }
     }
+    // BG tiles may share the pattern, so wherever they are visible has to
+    // be redrawn.
+    if (changed) {
+      m_pattern_gen++;
+      damageAll();
+    }
+  }
+
+  // XXX: should the first case be allowed to happen?
+  int pitch = py < m_current_mode.y ? textPitch() : offscreenPitch();
 
-    // XXX: should the first case be allowed to happen?
-    int pitch = py < m_current_mode.y ? textPitch() : offscreenPitch();
+  rz_surface_t in(s->p.w, s->p.h, (uint32_t *)(&pixelText(px, py)),
+                  pitch * sizeof(pixel_t), 0);
 
-    rz_surface_t in(s->p.w, s->p.h, (uint32_t *)(&pixelText(px, py)),
-                    pitch * sizeof(pixel_t), 0);
+  rz_surface_t *out = rotozoomSurfaceXY(
+          &in, s->angle, s->p.flip_x ? -s->scale_x : s->scale_x,
+          s->p.flip_y ? -s->scale_y : s->scale_y, 0);
+  s->surf = out;
+  s->must_reload = false;
 
-    rz_surface_t *out = rotozoomSurfaceXY(
-            &in, s->angle, s->p.flip_x ? -s->scale_x : s->scale_x,
-            s->p.flip_y ? -s->scale_y : s->scale_y, 0);
-    s->surf = out;
-    s->must_reload = false;
+  s->row_class.resize(out->h);
+  for (int y = 0; y < out->h; ++y)
+    s->row_class[y] = alpha_class(&out->pixels[y * out->w], out->w, out->w, 1);
+}
+
+// Reloads the sprites that have been changed, and records the areas they
+// are going to cover. Has to be done before the damage is collected
+// because the size of a sprite may change when it is reloaded. Must be
+// called with the sprites locked.
+void GFXCLASS::prepareSprites() {
+  for (int si = 0; si < MAX_SPRITES; ++si) {
+    sprite_t *s = &m_sprite[si];
+    if (!s->enabled || (!s->must_reload && s->surf))
+      continue;
+
+    if (sprite_offscreen(s->pos_x, s->pos_y, s->p.w, s->p.h, width(),
+                         height()))
+      continue;
+
+    loadSprite(s);
+    damage(s->pos_x, s->pos_y, s->surf->w, s->surf->h);
+  }
+}
+
+// Draws the part of a sprite that lies within clip. Must be called with
+// the sprites locked, after prepareSprites(); sprites changed since then
+// are drawn as they were and have damaged the screen for the next frame.
+void GFXCLASS::drawSprite(sprite_t *s, const Rect &clip) {
+  if (!s->surf || sprite_offscreen(s->pos_x, s->pos_y, s->p.w, s->p.h,
+                                   width(), height()))
+    return;
+
+  int x0 = _max(s->pos_x, clip.x);
+  int y0 = _max(s->pos_y, clip.y);
+  int x1 = _min(s->pos_x + s->surf->w, clip.x + clip.width);
+  int y1 = _min(s->pos_y + s->surf->h, clip.y + clip.height);
+
+  if (x0 >= x1 || y0 >= y1)
+    return;
+
+  // Opaque sprites ignore the alpha channel of their pixels. Otherwise,
+  // rows of the same alpha class are drawn together.
+  int src_x = x0 - s->pos_x;
+  for (int y = y0; y < y1;) {
+    int cls = s->p.opaque ? ALPHA_OPAQUE : s->row_class[y - s->pos_y];
+    int end = y + 1;
+    while (end < y1 &&
+           (s->p.opaque || s->row_class[end - s->pos_y] == cls))
+      ++end;
+
+    draw_alpha_block(cls, &pixelComp(x0, y), compositePitch(),
+                     &s->surf->pixels[(y - s->pos_y) * s->surf->w + src_x],
+                     s->surf->w, x1 - x0, end - y);
+    y = end;
+  }
+}
+
+// Composes BGs, external layers and sprites on top of the text layer
+// within the given area of the composite surface.
+void GFXCLASS::composeRect(const Rect &r) {
+  for (int prio = 0; prio <= MAX_PRIO; ++prio) {
+    for (int b = 0; b < MAX_BG; ++b) {
+      bg_t *bg = &m_bg[b];
+      if (!bg->enabled || bg->prio != prio)
+        continue;
+      drawBg(bg, r);
+    }
+    // External layers always paint the whole screen; the compositor
+    // makes sure the whole screen is damaged when there are any.
+    for (auto l : m_external_layers) {
+      if (l.prio == prio)
+        l.painter(&pixelComp(0, 0), m_current_mode.x, m_current_mode.y,
+                  compositePitch(), l.userdata);
+    }
+
+    for (int si = 0; si < MAX_SPRITES; ++si) {
+      sprite_t *s = &m_sprite[si];
+      // skip if not visible
+      if (!s->enabled || s->prio != prio)
+        continue;
+      drawSprite(s, r);
+    }
   }
+}
+
+// Composes the parts of the given areas that lie within one of a number of
+// horizontal bands of equal height, starting with the text layer if
+// copy_text is set. Bands do not overlap and can be composed concurrently;
+// the areas are composed in order, so the result is the same as that of
+// composing them on the whole screen.
+void GFXCLASS::composeBand(const Rect *rects, int count, int band, int bands,
+                           bool copy_text) {
+  int band_y0 = m_current_mode.y * band / bands;
+  int band_y1 = m_current_mode.y * (band + 1) / bands;
 
-  int dst_x = s->pos_x;
-  int dst_y = s->pos_y;
-  int blit_width = s->surf->w;
-  int blit_height = s->surf->h;
-  int src_x = 0;
-  int src_y = 0;
-
-  if (dst_x < 0) {
-    blit_width += dst_x;
-    src_x -= dst_x;
-    dst_x = 0;
-  } else if (dst_x + blit_width >= m_current_mode.x)
-    blit_width = m_current_mode.x - dst_x;
-
-  if (dst_y < 0) {
-    blit_height += dst_y;
-    src_y -= dst_y;
-    dst_y = 0;
-  } else if (dst_y + blit_height >= m_current_mode.y)
-    blit_height = m_current_mode.y - dst_y;
-
-  overlay_alpha_stride_div255_round_approx(
-          (uint8_t *)&pixelComp(dst_x, dst_y),
-          (uint8_t *)&s->surf->pixels[src_y * s->surf->w + src_x],
-          (uint8_t *)&pixelComp(dst_x, dst_y),
-          compositePitch(), blit_height,
-          blit_width, s->surf->w);
-  UNLOCK_SPRITES
+  for (int i = 0; i < count; ++i) {
+    Rect r = rects[i];
+    int y0 = _max(r.y, band_y0);
+    int y1 = _min(r.y + r.height, band_y1);
+    if (y0 >= y1)
+      continue;
+    r.y = y0;
+    r.height = y1 - y0;
+
+    // Areas may overlap (H3 adds the damage of the previous frame to that
+    // of the current one), so the text layer is copied right before each
+    // area is composed; otherwise the overlap would be blended twice.
+    if (copy_text) {
+      for (int y = r.y; y < r.y + r.height; ++y)
+        memcpy(&pixelComp(r.x, y), &pixelText(r.x, y),
+               r.width * sizeof(pixel_t));
+    }
+    composeRect(r);
+  }
 }
@@ -6,6 +6,7 @@
 #include "h3audio.h"
 #include <h3_codec.h>
 #include <audio.h>
+#include <attention.h>
 
 #ifdef JAILHOUSE
 #include <video_encoder.h>
@@ -47,6 +48,8 @@ void hook_audio_get_sample(int16_t *l, int16_t *r) {
     audio.m_curr_buf = audio.m_sound_buf[(m_read_buf + 1) % SOUND_BUFFERS];
     audio.m_curr_buf_pos = 0;
     m_read_pos = 0;
+    // needs new samples
+    request_attention();
 
 #ifdef AWBM_PLATFORM_h3
     h3_codec_push_data(audio.m_curr_buf);
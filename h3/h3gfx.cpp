@@ -95,6 +95,36 @@ extern "C" void task_updatebg(void) {
   }
 }
 
+// Cores composing a band of the screen each in addition to the display
+// core. Under Jailhouse the remaining cores belong to the root cell.
+#ifdef JAILHOUSE
+#define COMPOSE_CORES		0
+#else
+#define COMPOSE_CORES		2
+#define FIRST_COMPOSE_CORE	2
+#endif
+
+#define COMPOSE_CORE_STACK_SIZE 0x1000
+
+#if COMPOSE_CORES > 0
+static void compose_task(int worker) {
+  for (;;) {
+    smp_wait_for_event();
+    vs23.composeWorker(worker);
+  }
+}
+
+extern "C" void task_compose0(void) {
+  compose_task(0);
+}
+
+#if COMPOSE_CORES > 1
+extern "C" void task_compose1(void) {
+  compose_task(1);
+}
+#endif
+#endif
+
 void hook_display_vblank(void) {
   smp_send_event();
 }
@@ -200,6 +230,8 @@ void H3GFX::stopCapture() {
 
 #include <usb.h>
 #include <config.h>
+#include <attention.h>
+#include <timing.h>
 void H3GFX::begin(bool interlace, bool lowpass, uint8_t system) {
   video_encoder->enabled = false;
   m_capture_enabled = false;
@@ -246,13 +278,34 @@ void H3GFX::begin(bool interlace, bool lowpass, uint8_t system) {
   }
 
   m_buffer_lock = false;
+  m_damage_lock = false;
   m_display_enabled = true;
   m_engine_enabled = false;
   m_bg_modified = false;
-  m_textmode_buffer_modified = false;
+
+  m_compose_cores = 0;
+  for (int i = 0; i < COMPOSE_CORES; ++i)
+    m_compose_go[i] = false;
 
   smp_start_secondary_core(DISPLAY_CORE, task_updatebg, display_core_stack,
                            DISPLAY_CORE_STACK_SIZE);
+
+#if COMPOSE_CORES > 0
+  void (*compose_tasks[])(void) = {
+    task_compose0,
+#if COMPOSE_CORES > 1
+    task_compose1,
+#endif
+  };
+  for (int i = 0; i < COMPOSE_CORES; ++i) {
+    void *stack = malloc(COMPOSE_CORE_STACK_SIZE);
+    if (!stack)
+      break;
+    smp_start_secondary_core(FIRST_COMPOSE_CORE + i, compose_tasks[i],
+                             stack, COMPOSE_CORE_STACK_SIZE);
+    m_compose_cores = i + 1;
+  }
+#endif
 }
 
 void H3GFX::reset() {
@@ -260,6 +313,7 @@ void H3GFX::reset() {
   // XXX: does this make sense?
   for (int i = 0; i < m_last_line; ++i)
     memset(&pixelText(0, i), 0, m_current_mode.x * sizeof(pixel_t));
+  damageText(0, m_last_line);
   setColorSpace(DEFAULT_COLORSPACE);
 }
 
@@ -396,6 +450,11 @@ bool H3GFX::setMode(uint8_t mode) {
   resetLinePointers(m_pixels, (pixel_t *)m_textmode_buffer);
   resetLinePointers(m_bgpixels, (pixel_t *)display_active_buffer);
 
+  resetDamage();
+  Rect all = { 0, 0, m_current_mode.x, m_current_mode.y };
+  m_prev_damage[0] = all;
+  m_prev_damage_count = 1;
+
   m_display_enabled = true;
 
   m_engine_enabled = false;
@@ -468,65 +527,102 @@ void H3GFX::updateBgTask() {
   do_capture();
 #endif
 
+  // We are woken up on every vertical blank, so ticks beyond those skipped
+  // deliberately have passed while the previous frame was being composed.
+  static uint32_t last_frame_start = 0;
+  uint32_t frame_start = micros();
+  if (last_frame) {
+    timing_record(EB_TIMING_FRAME, frame_start - last_frame_start);
+    if (tick_counter > last_frame + m_frameskip + 1)
+      timing_missed_frames(tick_counter - last_frame - m_frameskip - 1);
+  }
+  last_frame_start = frame_start;
+
   last_frame = tick_counter;
 
-  if (!m_bg_modified && (!m_textmode_buffer_modified || display_single_buffer)) {
+  spin_lock(&m_buffer_lock);
+  lockSprites();
+
+  prepareSprites();
+  prepareBgs();
+  if (externalLayersActive())
+    damageAll();
+
+  // Anything changed since the last frame has to be redrawn, and so has
+  // everything that changed in the frame before, which went into the other
+  // buffer.
+  Rect damage[MAX_DAMAGE_RECTS * 2];
+  int count = takeDamage(damage);
+  if (!count) {
+    unlockSprites();
+    spin_unlock(&m_buffer_lock);
     m_frame++;
+    request_attention();
     smp_send_event();
     return;
   }
 
-  spin_lock(&m_buffer_lock);
+  int cur_count = count;
+  for (int i = 0; i < m_prev_damage_count; ++i)
+    damage[count++] = m_prev_damage[i];
+  memcpy(m_prev_damage, damage, cur_count * sizeof(Rect));
+  m_prev_damage_count = cur_count;
+
+  bool full = false;
+  for (int i = 0; i < count; ++i) {
+    if (damage[i].width == m_current_mode.x &&
+        damage[i].height == m_current_mode.y) {
+      damage[0] = damage[i];
+      count = 1;
+      full = true;
+      break;
+    }
+  }
 
+  uint32_t compose_start = micros();
 #ifdef PROFILE_BG
-  uint32_t start = micros();
+  uint32_t start = compose_start;
 #endif
 
-  // Text screen layer goes at the bottom.
-  m_textmode_buffer_modified = false;
-  blitBuffer((pixel_t *)display_active_buffer, m_textmode_buffer);
+  // Text screen layer goes at the bottom. A full screen update includes
+  // the borders; otherwise the text layer is copied per band.
+  if (full)
+    blitBuffer((pixel_t *)display_active_buffer, m_textmode_buffer);
 
   m_bg_modified = false;
 
 #ifdef PROFILE_BG
   uint32_t textblit = micros() - start;
 #endif
-  for (int prio = 0; prio <= MAX_PRIO; ++prio) {
-    for (int b = 0; b < MAX_BG; ++b) {
-      bg_t *bg = &m_bg[b];
-      if (!bg->enabled || bg->prio != prio)
-        continue;
-      drawBg(bg);
-    }
-    for (auto l : m_external_layers) {
-      if (l.prio == prio) {
-        l.painter(&pixelComp(0, 0), m_current_mode.x, m_current_mode.y,
-                  compositePitch(), l.userdata);
-        m_bg_modified = true;
-      }
-    }
-
-    for (int si = 0; si < MAX_SPRITES; ++si) {
-      sprite_t *s = &m_sprite[si];
-      // skip if not visible
-      if (!s->enabled || s->prio != prio)
-        continue;
-      drawSprite(s);
-    }
-  }
+  composeBands(damage, count, !full);
+  unlockSprites();
 
 #ifdef PROFILE_BG
   uint32_t background = micros() - start - textblit;
 #endif
 
+  uint32_t upload_start = micros();
+  timing_record(EB_TIMING_COMPOSE, upload_start - compose_start);
+
   // Not doing this produces a nice distortion effect...
-  cleanCache();
+  if (full) {
+    cleanCache();
+  } else {
+    for (int i = 0; i < count; ++i) {
+      mmu_flush_dcache_range((void *)&pixelComp(0, damage[i].y),
+                             damage[i].height * compositePitch() *
+                                     sizeof(pixel_t),
+                             MMU_DCACHE_CLEAN);
+    }
+  }
 
   display_swap_buffers();
   resetLinePointers(m_bgpixels, (pixel_t *)display_active_buffer);
 
   spin_unlock(&m_buffer_lock);
 
+  timing_record(EB_TIMING_UPLOAD, micros() - upload_start);
+
 #ifdef PROFILE_BG
   uint32_t finish = micros() - start - textblit - background;
   printf("textblit %lu background %lu finish %lu total %lu\n", textblit,
@@ -534,9 +630,54 @@ void H3GFX::updateBgTask() {
 #endif
 
   m_frame++;
+  request_attention();
   smp_send_event();
 }
 
+// Composes the band assigned to worker, if there is one.
+void H3GFX::composeWorker(int worker) {
+  if (!m_compose_go[worker])
+    return;
+  __sync_synchronize();
+  composeBand(m_compose_rects, m_compose_count, worker, m_compose_bands,
+              m_compose_text);
+  __sync_synchronize();
+  m_compose_go[worker] = false;
+}
+
+// Composes the given areas, split into as many bands as there are
+// compositor threads. The display core takes the last band.
+void H3GFX::composeBands(const Rect *rects, int count, bool copy_text) {
+  int bands = CONFIG.compose_threads;
+  if (!bands)
+    bands = m_compose_cores + 1;
+  // External layers paint the whole screen at once.
+  if (externalLayersActive())
+    bands = 1;
+  bands = _max(1, _min(bands, m_compose_cores + 1));
+
+  m_compose_rects = rects;
+  m_compose_count = count;
+  m_compose_bands = bands;
+  m_compose_text = copy_text;
+  __sync_synchronize();
+
+  if (bands > 1) {
+    for (int i = 0; i < bands - 1; ++i)
+      m_compose_go[i] = true;
+    __sync_synchronize();
+    smp_send_event();
+  }
+
+  composeBand(rects, count, bands - 1, bands, copy_text);
+
+  for (int i = 0; i < bands - 1; ++i) {
+    while (m_compose_go[i])
+      ;
+  }
+  __sync_synchronize();
+}
+
 #ifdef USE_BG_ENGINE
 #include "../gfx/spritecoll.h"
 #endif  // USE_BG_ENGINE
@@ -96,9 +96,13 @@ public:
 
 #ifdef USE_BG_ENGINE
   void updateBgTask();
+  void composeWorker(int worker);
 
   inline void setSpriteOpaque(uint8_t num, bool enable) {
-    m_sprite[num].p.opaque = enable;
+    if (m_sprite[num].p.opaque != enable) {
+      m_sprite[num].p.opaque = enable;
+      damageSprite(&m_sprite[num]);
+    }
   }
 
   uint8_t spriteCollision(uint8_t collidee, uint8_t collider);
@@ -114,7 +118,7 @@ public:
 
   inline void setPixel(uint16_t x, uint16_t y, pixel_t c) {
     m_pixels[y][x] = c;
-    m_textmode_buffer_modified = true;
+    damageText(y, 1);
   }
   inline void setPixelIndexed(uint16_t x, uint16_t y, ipixel_t c) {
     if (csp.getColorSpace() == 2) {
@@ -122,7 +126,7 @@ public:
       return;
     }
     m_pixels[y][x] = m_current_palette[c];
-    m_textmode_buffer_modified = true;
+    damageText(y, 1);
   }
   void setPixelRgb(uint16_t xpos, uint16_t ypos, uint8_t r, uint8_t g, uint8_t b);
   inline pixel_t getPixel(uint16_t x, uint16_t y) {
@@ -153,7 +157,7 @@ public:
 
   inline void setPixels(pixel_t *address, pixel_t *data, uint32_t len) {
     memcpy(address, data, len * sizeof(pixel_t));
-    m_textmode_buffer_modified = true;
+    damageTextAddr(address, len);
   }
   inline void setPixelsIndexed(pixel_t *address, ipixel_t *data, uint32_t len) {
     if (csp.getColorSpace() == 2) {
@@ -161,8 +165,8 @@ public:
       return;
     }
     for (uint32_t i = 0; i < len; ++i)
-      *address++ = m_current_palette[*data++];
-    m_textmode_buffer_modified = true;
+      address[i] = m_current_palette[data[i]];
+    damageTextAddr(address, len);
   }
 
   inline pixel_t *pixelAddr(int x, int y) {
@@ -179,10 +183,37 @@ public:
 
 protected:
   void updateStatus() override;
+  void lockDamage() override {
+    spin_lock(&m_damage_lock);
+  }
+  void unlockDamage() override {
+    spin_unlock(&m_damage_lock);
+  }
 
 private:
-  void drawBg(bg_t *bg);
-  void drawSprite(sprite_t *s);
+  void drawBg(bg_t *bg, const Rect &clip);
+  void drawSprite(sprite_t *s, const Rect &clip);
+  void loadSprite(sprite_t *s);
+  void prepareSprites();
+  void prepareBgs();
+  void composeRect(const Rect &r);
+  void composeBand(const Rect *rects, int count, int band, int bands,
+                   bool copy_text);
+  void composeBands(const Rect *rects, int count, bool copy_text);
+
+  // Records the text layer lines touched by a write of len pixels. Writes
+  // outside the text-mode buffer go to off-screen memory.
+  inline void damageTextAddr(pixel_t *address, uint32_t len) {
+    int off = address - m_textmode_buffer;
+    int size = textPitch() * (m_current_mode.y + m_current_mode.top);
+    if (off < 0 || off >= size) {
+      damageText(-1, 1);
+      return;
+    }
+    int first = off / textPitch() - m_current_mode.top;
+    int last = (off + len - 1) / textPitch() - m_current_mode.top;
+    damageText(first, last - first + 1);
+  }
 
   inline void blitBuffer(pixel_t *dst, pixel_t *buf);
   void resetLinePointers(pixel_t **pixels, pixel_t *buffer);
@@ -194,9 +225,22 @@ private:
   bool m_display_enabled;
   bool m_force_filter;
   bool m_engine_enabled;
-  bool m_textmode_buffer_modified;
   bool m_capture_enabled;
   spinlock_t m_buffer_lock;
+  spinlock_t m_damage_lock;
+
+  // Damage composed into the other frame buffer; it has to be recomposed
+  // into this one as well.
+  Rect m_prev_damage[MAX_DAMAGE_RECTS];
+  int m_prev_damage_count;
+
+  // Band composition on the other cores; worker n composes band n.
+  int m_compose_cores;
+  volatile bool m_compose_go[MAX_COMPOSE_THREADS];
+  const Rect *m_compose_rects;
+  int m_compose_count;
+  int m_compose_bands;
+  bool m_compose_text;
 
   // Used by text mode, pixel graphics functions. Points to
   // m_textmode_buffer's pixels when BG engine is on, and display device
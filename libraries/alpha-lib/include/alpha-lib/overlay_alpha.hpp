@@ -125,4 +125,29 @@ inline void overlay_alpha_stride(const uint8_t (&bg_img)[4],
                          fg_rows, fg_cols, fg_full_cols);
 }
 
+/// Instruction set extensions used by the overlay functions.
+enum class OverlayAlphaISA {
+    /// NEON on ARM, plain C++ elsewhere.
+    Generic,
+    /// SSE2 (x86 only).
+    SSE2,
+    /// AVX2 (x86 only).
+    AVX2,
+};
+
+/**
+ * @brief   Select the instruction set extensions used by the overlay 
+ *          functions.
+ * 
+ * On x86, AVX2 is used by default if the processor supports it, and SSE2
+ * otherwise. This function can be used to compare the implementations. It
+ * must not be called while an overlay function is running.
+ * 
+ * @param   isa
+ *          The instruction set to use.
+ * @return  The instruction set actually used, which is the closest one
+ *          supported by the processor and the build.
+ */
+OverlayAlphaISA overlay_alpha_select_isa(OverlayAlphaISA isa);
+
 /// @}
\ No newline at end of file
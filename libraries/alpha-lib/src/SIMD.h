@@ -11,3 +11,20 @@
 #endif
 #define ENABLE_SIMD32 0
 #endif
+
+// On x86, SSE2 is part of the x86-64 baseline. The AVX2 code is compiled for
+// that instruction set only, and selected at run time if the processor
+// supports it.
+#if !ENABLE_NEON && defined(__SSE2__) && !defined(DISABLE_SSE)
+#include <immintrin.h>
+#define ENABLE_SSE2 1
+#ifdef __GNUC__
+#define ENABLE_AVX2 1
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define ENABLE_AVX2 0
+#endif
+#else
+#define ENABLE_SSE2 0
+#define ENABLE_AVX2 0
+#endif
@@ -146,6 +146,73 @@ inline uint8x8_t div255_round(uint16x8_t x) {
 
 #endif // NEON
 
+#if ENABLE_SSE2
+
+/*
+ * The x86 versions work on eight 16-bit products and return the results in
+ * the low bytes of the 16-bit elements. They produce the same results as the
+ * scalar versions below, including Div255_Round_Approx, which is exact here
+ * because an exact rounding division costs no more than the approximation.
+ */
+
+/// @copydoc div256_floor(uint16x8_t)
+inline __m128i div256_floor(__m128i x) { return _mm_srli_epi16(x, 8); }
+
+/// @copydoc div256_round(uint16x8_t)
+inline __m128i div256_round(__m128i x) {
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_set1_epi16(1 << 7)), 8);
+}
+
+/// @copydoc div255_floor(uint16x8_t)
+inline __m128i div255_floor(__m128i x) {
+    // (x × 0x8081) >> 23, the 16 high bits of the product are divided by 0x80
+    return _mm_srli_epi16(_mm_mulhi_epu16(x, _mm_set1_epi16(0x8081)), 7);
+}
+
+/// @copydoc div255_round(uint16x8_t)
+inline __m128i div255_round(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(1 << 7));
+    // (x × 0x101) >> 16
+    return _mm_mulhi_epu16(x, _mm_set1_epi16(0x101));
+}
+
+/// Uses div255_round, and is exact.
+inline __m128i div255_round_approx(__m128i x) { return div255_round(x); }
+
+#endif // SSE2
+
+#if ENABLE_AVX2
+
+/// @copydoc div256_floor(__m128i)
+TARGET_AVX2 inline __m256i div256_floor(__m256i x) {
+    return _mm256_srli_epi16(x, 8);
+}
+
+/// @copydoc div256_round(__m128i)
+TARGET_AVX2 inline __m256i div256_round(__m256i x) {
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_set1_epi16(1 << 7)),
+                             8);
+}
+
+/// @copydoc div255_floor(__m128i)
+TARGET_AVX2 inline __m256i div255_floor(__m256i x) {
+    return _mm256_srli_epi16(_mm256_mulhi_epu16(x, _mm256_set1_epi16(0x8081)),
+                             7);
+}
+
+/// @copydoc div255_round(__m128i)
+TARGET_AVX2 inline __m256i div255_round(__m256i x) {
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(1 << 7));
+    return _mm256_mulhi_epu16(x, _mm256_set1_epi16(0x101));
+}
+
+/// Uses div255_round, and is exact.
+TARGET_AVX2 inline __m256i div255_round_approx(__m256i x) {
+    return div255_round(x);
+}
+
+#endif // AVX2
+
 /**
  * This is a flooring division by 256, which is close enough to 255, but the
  * result may be one bit too small.
@@ -209,6 +276,36 @@ inline uint8x8_t rescale(uint16x8_t x) {
 }
 #endif
 
+#if ENABLE_SSE2
+/// @copydoc rescale(uint16x8_t)
+template <RescaleType rescale_type = RescaleType::Div255_Round>
+inline __m128i rescale(__m128i x) {
+    switch (rescale_type) {
+        case RescaleType::Div256_Floor: return div256_floor(x);
+        case RescaleType::Div256_Round: return div256_round(x);
+        case RescaleType::Div255_Floor: return div255_floor(x);
+        case RescaleType::Div255_Round: return div255_round(x);
+        case RescaleType::Div255_Round_Approx: return div255_round_approx(x);
+        default: return _mm_setzero_si128();
+    }
+}
+#endif
+
+#if ENABLE_AVX2
+/// @copydoc rescale(uint16x8_t)
+template <RescaleType rescale_type = RescaleType::Div255_Round>
+TARGET_AVX2 inline __m256i rescale(__m256i x) {
+    switch (rescale_type) {
+        case RescaleType::Div256_Floor: return div256_floor(x);
+        case RescaleType::Div256_Round: return div256_round(x);
+        case RescaleType::Div255_Floor: return div255_floor(x);
+        case RescaleType::Div255_Round: return div255_round(x);
+        case RescaleType::Div255_Round_Approx: return div255_round_approx(x);
+        default: return _mm256_setzero_si256();
+    }
+}
+#endif
+
 /// @copydoc rescale(uint16x8_t)
 template <RescaleType rescale_type = RescaleType::Div255_Round>
 inline uint8_t rescale(uint16_t x) {
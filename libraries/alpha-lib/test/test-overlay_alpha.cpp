@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include "../src/rescale.hpp"
+#include <alpha-lib/overlay_alpha.h>
 #include <alpha-lib/overlay_alpha.hpp>
 
 #include <algorithm>
@@ -176,3 +177,170 @@ TEST(overlay_alpha, rescale_div255_round_approx_1) {
     EXPECT_LE(*std::max_element(differences.begin(), differences.end()), 0);
     EXPECT_GE(*std::min_element(differences.begin(), differences.end()), -1);
 }
+
+#if ENABLE_SSE2
+
+// The x86 versions have to match the scalar versions exactly for all
+// products of two 8-bit values.
+template <RescaleType rescale_type>
+static void check_rescale_sse2() {
+    std::vector<uint16_t> in(255 * 255 + 1);
+    std::iota(std::begin(in), std::end(in),
+              std::numeric_limits<uint16_t>::min());
+    in.resize((in.size() + 7) / 8 * 8, 255 * 255);
+    std::vector<uint16_t> expected(in.size());
+    std::vector<uint16_t> result(in.size());
+
+    for (size_t i = 0; i < in.size(); i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)&in[i]);
+        _mm_storeu_si128((__m128i *)&result[i], rescale<rescale_type>(x));
+        for (size_t j = 0; j < 8; ++j)
+            expected[i + j] = rescale<rescale_type>(in[i + j]);
+    }
+    EXPECT_EQ(result, expected);
+}
+
+TEST(overlay_alpha, rescale_sse2) {
+    check_rescale_sse2<RescaleType::Div256_Floor>();
+    check_rescale_sse2<RescaleType::Div256_Round>();
+    check_rescale_sse2<RescaleType::Div255_Floor>();
+    check_rescale_sse2<RescaleType::Div255_Round>();
+    check_rescale_sse2<RescaleType::Div255_Round_Approx>();
+}
+
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+/// Straightforward scalar implementation to compare against.
+template <RescaleType rescale_type>
+static void overlay_alpha_reference(const uint8_t *bg_img,
+                                    const uint8_t *fg_img, uint8_t *out_img,
+                                    size_t bg_full_cols, size_t fg_rows,
+                                    size_t fg_cols, size_t fg_full_cols) {
+    for (size_t r = 0; r < fg_rows; ++r) {
+        for (size_t c = 0; c < fg_cols; ++c) {
+            const uint8_t *bg = &bg_img[4 * (r * bg_full_cols + c)];
+            const uint8_t *fg = &fg_img[4 * (r * fg_full_cols + c)];
+            uint8_t *out      = &out_img[4 * (r * bg_full_cols + c)];
+            uint16_t alpha    = fg[3];
+            for (size_t i = 0; i < 3; ++i)
+                out[i] = rescale<rescale_type>(
+                    uint16_t(fg[i] * alpha + bg[i] * (255 - alpha)));
+            out[3] = bg[3];
+        }
+    }
+}
+
+static std::vector<uint8_t> random_image(std::mt19937 &rng, size_t pixels) {
+    std::uniform_int_distribution<int> dist(0, 255);
+    std::vector<uint8_t> img(4 * pixels);
+    for (auto &b : img)
+        b = dist(rng);
+    // Include fully transparent and fully opaque pixels
+    for (size_t i = 0; i < pixels; i += 5)
+        img[4 * i + 3] = (i / 5) % 2 ? 255 : 0;
+    return img;
+}
+
+static const OverlayAlphaISA all_isas[] = {
+    OverlayAlphaISA::Generic,
+    OverlayAlphaISA::SSE2,
+    OverlayAlphaISA::AVX2,
+};
+
+template <RescaleType rescale_type>
+static void check_overlay_alpha_stride() {
+    std::mt19937 rng(1234);
+    const size_t bg_full_cols = 67, fg_full_cols = 41, rows = 13;
+    auto bg = random_image(rng, bg_full_cols * rows);
+    auto fg = random_image(rng, fg_full_cols * rows);
+
+    for (auto isa : all_isas) {
+        OverlayAlphaISA used = overlay_alpha_select_isa(isa);
+        if (used != isa)
+            continue;
+        for (size_t cols = 1; cols <= fg_full_cols; ++cols) {
+            auto expected = bg;
+            auto result   = bg;
+            overlay_alpha_reference<rescale_type>(bg.data(), fg.data(),
+                                                  expected.data(), bg_full_cols,
+                                                  rows, cols, fg_full_cols);
+            overlay_alpha_stride<rescale_type>(bg.data(), fg.data(),
+                                               result.data(), bg_full_cols,
+                                               rows, cols, fg_full_cols);
+            EXPECT_EQ(result, expected)
+                << "ISA " << int(isa) << ", " << cols << " columns";
+        }
+    }
+    overlay_alpha_select_isa(OverlayAlphaISA::AVX2);
+}
+
+TEST(overlay_alpha, stride_bit_exact) {
+    check_overlay_alpha_stride<RescaleType::Div256_Floor>();
+    check_overlay_alpha_stride<RescaleType::Div256_Round>();
+    check_overlay_alpha_stride<RescaleType::Div255_Floor>();
+    check_overlay_alpha_stride<RescaleType::Div255_Round>();
+#if !ENABLE_NEON
+    // The NEON version is an approximation, the others are exact.
+    check_overlay_alpha_stride<RescaleType::Div255_Round_Approx>();
+#endif
+}
+
+TEST(overlay_alpha, stride_in_place) {
+    std::mt19937 rng(5678);
+    const size_t cols = 29, rows = 7;
+    auto bg = random_image(rng, cols * rows);
+    auto fg = random_image(rng, cols * rows);
+
+    for (auto isa : all_isas) {
+        if (overlay_alpha_select_isa(isa) != isa)
+            continue;
+        auto expected = bg;
+        auto result   = bg;
+        overlay_alpha_stride<RescaleType::Div255_Round>(
+            bg.data(), fg.data(), expected.data(), cols, rows, cols, cols);
+        overlay_alpha_stride<RescaleType::Div255_Round>(
+            result.data(), fg.data(), result.data(), cols, rows, cols, cols);
+        EXPECT_EQ(result, expected) << "ISA " << int(isa);
+    }
+    overlay_alpha_select_isa(OverlayAlphaISA::AVX2);
+}
+
+// Not a test as such; prints the throughput of each implementation for a
+// typical sprite-sized foreground on a 640x480 background.
+TEST(overlay_alpha, benchmark) {
+    std::mt19937 rng(42);
+    const size_t bg_cols = 640, bg_rows = 480;
+    const size_t fg_cols = 100, fg_rows = 100;
+    const int iterations = 200;
+    auto bg = random_image(rng, bg_cols * bg_rows);
+    auto fg = random_image(rng, fg_cols * fg_rows);
+
+    using clock = std::chrono::steady_clock;
+    auto start  = clock::now();
+    for (int i = 0; i < iterations; ++i)
+        overlay_alpha_reference<RescaleType::Div255_Round_Approx>(
+            bg.data(), fg.data(), bg.data(), bg_cols, fg_rows, fg_cols,
+            fg_cols);
+    double reference = std::chrono::duration<double>(clock::now() - start)
+                           .count();
+    printf("reference: %8.1f Mpixel/s\n",
+           iterations * fg_rows * fg_cols / reference / 1e6);
+
+    for (auto isa : all_isas) {
+        if (overlay_alpha_select_isa(isa) != isa)
+            continue;
+        start = clock::now();
+        for (int i = 0; i < iterations; ++i)
+            overlay_alpha_stride_div255_round_approx(bg.data(), fg.data(),
+                                                     bg.data(), bg_cols,
+                                                     fg_rows, fg_cols, fg_cols);
+        double t = std::chrono::duration<double>(clock::now() - start).count();
+        printf("ISA %d:     %8.1f Mpixel/s (%.1fx)\n", int(isa),
+               iterations * fg_rows * fg_cols / t / 1e6, reference / t);
+    }
+    overlay_alpha_select_isa(OverlayAlphaISA::AVX2);
+}
@@ -5,6 +5,8 @@
 #include "sdlgfx.h"
 #include "colorspace.h"
 #include <joystick.h>
+#include <attention.h>
+#include <timing.h>
 
 SDLGFX vs23;
 
@@ -79,6 +81,11 @@ void SDLGFX::begin(bool interlace, bool lowpass, uint8_t system) {
 
   m_bufferlock = SDL_CreateMutex();
   m_spritelock = SDL_CreateMutex();
+  m_damagelock = SDL_CreateMutex();
+
+  m_compose_done = SDL_CreateSemaphore(0);
+  m_compose_workers = 0;
+  m_compose_quit = false;
 
   m_last_frame = SDL_GetPerformanceCounter();
   m_frame = 0;
@@ -109,8 +116,18 @@ void SDLGFX::end() {
   destroyWindow();
 #endif
 
+  m_compose_quit = true;
+  for (int i = 0; i < m_compose_workers; ++i) {
+    SDL_SemPost(m_compose_worker[i].start);
+    SDL_WaitThread(m_compose_worker[i].thread, NULL);
+    SDL_DestroySemaphore(m_compose_worker[i].start);
+  }
+  m_compose_workers = 0;
+  SDL_DestroySemaphore(m_compose_done);
+
   SDL_DestroyMutex(m_bufferlock);
   SDL_DestroyMutex(m_spritelock);
+  SDL_DestroyMutex(m_damagelock);
 
   SDL_Quit();
 
@@ -143,6 +160,11 @@ void SDLGFX::restart() {
 
   m_bufferlock = SDL_CreateMutex();
   m_spritelock = SDL_CreateMutex();
+  m_damagelock = SDL_CreateMutex();
+
+  m_compose_done = SDL_CreateSemaphore(0);
+  m_compose_workers = 0;
+  m_compose_quit = false;
 
   m_end_graphics = false;
 #ifndef __linux__
@@ -174,6 +196,7 @@ void SDLGFX::fillRect(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2,
   SDL_Rect dst = { (Sint16)x1, (Sint16)y1, x2 - x1, y2 - y1 };
 #pragma GCC diagnostic pop
   SDL_FillRect(m_text_surface, &dst, color);
+  damageText(y1, y2 - y1);
 }
 
 extern SDL_Renderer *sdl_renderer;
@@ -324,7 +347,9 @@ bool SDLGFX::setModeInternal(uint8_t mode) {
   m_bin.Init(m_current_mode.x, m_last_line - m_current_mode.y);
 
   m_display_enabled = true;
-  m_dirty = true;
+  m_upload_count = 0;
+  resetDamage();
+  updateRefreshPeriod();
 
   setBorder(0, 0, 0, m_current_mode.x);
 
@@ -343,6 +368,7 @@ void SDLGFX::toggleFullscreen() {
     else
       SDL_SetWindowFullscreen(sdl_window, SDL_WINDOW_FULLSCREEN_DESKTOP);
   }
+  updateRefreshPeriod();
 }
 
 #include <border_pal.h>
@@ -397,6 +423,17 @@ void SDLGFX::createWindow()
                                 SDL_WINDOWPOS_UNDEFINED, sdl_user_w, sdl_user_h,
                                 sdl_flags);
   sdl_renderer = SDL_CreateRenderer(sdl_window, -1, SDL_RENDERER_PRESENTVSYNC);
+  updateRefreshPeriod();
+}
+
+// Looks up the refresh rate of the display the window is on. Done when the
+// window is created or the mode changes, not on every frame.
+void SDLGFX::updateRefreshPeriod() {
+  SDL_DisplayMode dm;
+  if (SDL_GetWindowDisplayMode(sdl_window, &dm) || dm.refresh_rate <= 0)
+    m_refresh_period = 0;
+  else
+    m_refresh_period = 1000000 / dm.refresh_rate;
 }
 
 void SDLGFX::destroyWindow()
@@ -427,10 +464,19 @@ extern "C" int gfx_thread(void *data) {
       if (gfx->m_ready) {
         gfx->m_ready = false;
         SDL_LockMutex(gfx->m_bufferlock);
-        SDL_UpdateTexture(gfx->m_texture, NULL, gfx->m_composite_surface->pixels, gfx->m_composite_surface->pitch);
+        uint32_t start = micros();
+        for (int i = 0; i < gfx->m_upload_count; ++i) {
+          Rect &r = gfx->m_upload[i];
+          SDL_Rect dst = { r.x, r.y, r.width, r.height };
+          SDL_UpdateTexture(gfx->m_texture, &dst, &gfx->pixelComp(r.x, r.y),
+                            gfx->m_composite_surface->pitch);
+        }
+        gfx->m_upload_count = 0;
+        timing_record(EB_TIMING_UPLOAD, micros() - start);
         SDL_UnlockMutex(gfx->m_bufferlock);
       }
         gfx->m_frame++;
+        request_attention();
 
         SDL_RenderClear(sdl_renderer);
         SDL_RenderCopy(sdl_renderer, gfx->m_texture, NULL, NULL);
@@ -447,6 +493,8 @@ extern "C" int gfx_thread(void *data) {
         SDL_RenderPresent(sdl_renderer);
         now = SDL_GetPerformanceCounter();
         passed = now - last;
+        if (last)
+          gfx->frameTiming(passed * 1000000 / SDL_GetPerformanceFrequency());
         last = now;
     }
     //printf("frame %d passed %ld\n", gfx->m_frame, passed);
@@ -470,50 +518,118 @@ void SDLGFX::updateBgScale() {
 
   last_frame = frame();
 
-  if (!m_bg_modified && !m_dirty && m_external_layers.size() == 0) {
+  // Sprites must not change while the worker threads are drawing them.
+  lockSprites();
+
+  prepareSprites();
+  prepareBgs();
+  if (externalLayersActive())
+    damageAll();
+
+  Rect damage[MAX_DAMAGE_RECTS];
+  int count = takeDamage(damage);
+  if (!count) {
     // nothing going on
+    unlockSprites();
     return;
   }
 
-  memcpy(m_composite_surface->pixels, m_text_surface->pixels,
-         m_text_surface->pitch * m_current_mode.y);
+  uint32_t compose_start = micros();
 
   m_bg_modified = false;
-  m_dirty = false;
 
-#ifdef PROFILE_BG
-  uint32_t start = micros();
-#endif
-  for (int prio = 0; prio <= MAX_PRIO; ++prio) {
-    for (int b = 0; b < MAX_BG; ++b) {
-      bg_t *bg = &m_bg[b];
-      if (!bg->enabled || bg->prio != prio)
-        continue;
-      drawBg(bg);
-    }
-    for (auto l : m_external_layers) {
-      if (l.prio == prio)
-        l.painter(&pixelComp(0, 0), m_current_mode.x, m_current_mode.y,
-                  compositePitch(), l.userdata);
+  composeBands(damage, count);
+
+  unlockSprites();
+
+  // Areas not uploaded yet are merged into a full upload if there are too
+  // many of them. Once a full upload is queued, nothing else is needed.
+  Rect all = { 0, 0, m_current_mode.x, m_current_mode.y };
+  for (int i = 0; i < count; ++i) {
+    if (m_upload_count == 1 && m_upload[0].width == all.width &&
+        m_upload[0].height == all.height)
+      break;
+    bool full = damage[i].width == all.width &&
+                damage[i].height == all.height;
+    if (!full && m_upload_count < MAX_DAMAGE_RECTS) {
+      m_upload[m_upload_count++] = damage[i];
+    } else {
+      m_upload[0] = all;
+      m_upload_count = 1;
     }
+  }
 
-#ifdef PROFILE_BG
-    uint32_t taken = micros() - start;
-    Serial.printf("rend %d\r\n", taken);
-#endif
+  timing_record(EB_TIMING_COMPOSE, micros() - compose_start);
+  m_ready = true;
+}
 
-    for (int si = 0; si < MAX_SPRITES; ++si) {
-      sprite_t *s = &m_sprite[si];
+int SDLGFX::composeWorker(void *data) {
+  compose_worker_t *w = (compose_worker_t *)data;
+  SDLGFX *gfx = w->gfx;
+
+  for (;;) {
+    SDL_SemWait(w->start);
+    if (gfx->m_compose_quit)
+      break;
+    gfx->composeBand(gfx->m_compose_rects, gfx->m_compose_count, w->band,
+                     gfx->m_compose_bands, true);
+    SDL_SemPost(gfx->m_compose_done);
+  }
 
-      // skip if not visible
-      if (!s->enabled || s->prio != prio)
-        continue;
+  return 0;
+}
 
-      drawSprite(s);
+// Composes the given areas, split into as many bands as there are
+// compositor threads. Worker threads are started the first time they are
+// needed.
+void SDLGFX::composeBands(const Rect *rects, int count) {
+  int bands = CONFIG.compose_threads;
+  if (!bands)
+    bands = SDL_GetCPUCount();
+  // External layers paint the whole screen at once.
+  if (externalLayersActive())
+    bands = 1;
+  bands = _max(1, _min(bands, MAX_COMPOSE_THREADS));
+
+  while (m_compose_workers < bands - 1) {
+    compose_worker_t *w = &m_compose_worker[m_compose_workers];
+    w->gfx = this;
+    w->band = m_compose_workers;
+    w->start = SDL_CreateSemaphore(0);
+    w->thread = w->start ? SDL_CreateThread(composeWorker, "compose", w) :
+                           NULL;
+    if (!w->thread) {
+      if (w->start)
+        SDL_DestroySemaphore(w->start);
+      bands = m_compose_workers + 1;
+      break;
     }
+    m_compose_workers++;
   }
 
-  m_ready = true;
+  m_compose_rects = rects;
+  m_compose_count = count;
+  m_compose_bands = bands;
+
+  for (int i = 0; i < bands - 1; ++i)
+    SDL_SemPost(m_compose_worker[i].start);
+
+  composeBand(rects, count, bands - 1, bands, true);
+
+  for (int i = 0; i < bands - 1; ++i)
+    SDL_SemWait(m_compose_done);
+}
+
+// Records the time between two presented frames and counts the vertical
+// refreshes that passed without a new frame.
+void SDLGFX::frameTiming(uint32_t us) {
+  timing_record(EB_TIMING_FRAME, us);
+
+  uint32_t period = m_refresh_period;
+  if (!period)
+    return;
+  if (us > period * 3 / 2)
+    timing_missed_frames((us + period / 2) / period - 1);
 }
 
 void SDLGFX::lockSprites() {
@@ -524,6 +640,14 @@ void SDLGFX::unlockSprites() {
   UNLOCK_SPRITES
 }
 
+void SDLGFX::lockDamage() {
+  SDL_LockMutex(m_damagelock);
+}
+
+void SDLGFX::unlockDamage() {
+  SDL_UnlockMutex(m_damagelock);
+}
+
 #ifdef USE_BG_ENGINE
 #include "../gfx/spritecoll.h"
 #endif  // USE_BG_ENGINE
@@ -93,11 +93,16 @@ public:
   void updateBg();
 
   inline void setSpriteOpaque(uint8_t num, bool enable) {
-    m_sprite[num].p.opaque = enable;
+    if (m_sprite[num].p.opaque != enable) {
+      m_sprite[num].p.opaque = enable;
+      damageSprite(&m_sprite[num]);
+    }
   }
 
   void lockSprites() override;
   void unlockSprites() override;
+  void lockDamage() override;
+  void unlockDamage() override;
 
   uint8_t spriteCollision(uint8_t collidee, uint8_t collider);
 #endif
@@ -113,7 +118,7 @@ public:
 
   inline void setPixel(uint16_t x, uint16_t y, pixel_t c) {
     PIXELT(x, y) = c;
-    m_dirty = true;
+    damageText(y, 1);
   }
   inline void setPixelIndexed(uint16_t x, uint16_t y, ipixel_t c) {
 #if SDL_BPP == 8
@@ -125,7 +130,7 @@ public:
     }
     PIXELT(x, y) = m_current_palette[c];
 #endif
-    m_dirty = true;
+    damageText(y, 1);
   }
   void setPixelRgb(uint16_t xpos, uint16_t ypos,
                    uint8_t r, uint8_t g, uint8_t b);
@@ -158,9 +163,9 @@ public:
 
   inline void setPixels(pixel_t *address, pixel_t *data, uint32_t len) {
     for (uint32_t i = 0; i < len; ++i)
-      *address++ = data[i];
+      address[i] = data[i];
 
-    m_dirty = true;
+    damageTextAddr(address, len);
   }
 
   inline void setPixelsIndexed(pixel_t *address, ipixel_t *data, uint32_t len) {
@@ -172,12 +177,12 @@ public:
 #endif
     for (uint32_t i = 0; i < len; ++i)
 #if SDL_BPP == 8
-      *address++ = data[i];
+      address[i] = data[i];
 #else
-      *address++ = m_current_palette[data[i]];
+      address[i] = m_current_palette[data[i]];
 #endif
 
-    m_dirty = true;
+    damageTextAddr(address, len);
   }
 
   inline pixel_t *pixelAddr(int x, int y) {
@@ -194,11 +199,29 @@ public:
   }
 
 private:
-  void drawBg(bg_t *bg);
-  void drawSprite(sprite_t *s);
+  void drawBg(bg_t *bg, const Rect &clip);
+  void drawSprite(sprite_t *s, const Rect &clip);
+  void loadSprite(sprite_t *s);
+  void prepareSprites();
+  void prepareBgs();
+  void composeRect(const Rect &r);
+  void composeBand(const Rect *rects, int count, int band, int bands,
+                   bool copy_text);
+  void composeBands(const Rect *rects, int count);
+  static int composeWorker(void *data);
+
+  // Records the text layer lines touched by a write of len pixels.
+  inline void damageTextAddr(pixel_t *address, uint32_t len) {
+    int off = address - (pixel_t *)m_text_surface->pixels;
+    int first = off / textPitch();
+    int last = (off + len - 1) / textPitch();
+    damageText(first, last - first + 1);
+  }
 
   void createWindow();
   void destroyWindow();
+  void frameTiming(uint32_t us);
+  void updateRefreshPeriod();
 
   static Uint32 timerCallback(Uint32 t);
 
@@ -208,7 +231,29 @@ private:
   SDL_Surface *m_text_surface;
   SDL_Surface *m_composite_surface;
   SDL_Texture *m_texture;
-  bool m_dirty;
+
+  // Duration of a vertical refresh of the display in us, 0 if unknown
+  uint32_t m_refresh_period;
+
+  // Areas of the composite surface yet to be copied to the texture
+  Rect m_upload[MAX_DAMAGE_RECTS];
+  int m_upload_count;
+
+  // Compositor worker threads; worker n composes band n, the compositor
+  // itself the last one.
+  struct compose_worker_t {
+    SDLGFX *gfx;
+    int band;
+    SDL_Thread *thread;
+    SDL_sem *start;
+  };
+  compose_worker_t m_compose_worker[MAX_COMPOSE_THREADS - 1];
+  int m_compose_workers;
+  SDL_sem *m_compose_done;
+  const Rect *m_compose_rects;
+  int m_compose_count;
+  int m_compose_bands;
+  volatile bool m_compose_quit;
 
   Uint64 m_last_frame;
 
@@ -224,6 +269,7 @@ private:
 public:
   SDL_mutex *m_bufferlock;
   SDL_mutex *m_spritelock;
+  SDL_mutex *m_damagelock;
   void updateBgScale();
   volatile bool m_ready;
 
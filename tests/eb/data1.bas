@@ -0,0 +1,16 @@
+10 ' READ/RESTORE through the DATA index
+20 READ a,b$,c
+30 PRINT a;" ";b$;" ";c
+40 RESTORE 110
+50 READ a,b
+60 PRINT a;" ";b
+70 RESTORE &more
+80 READ a:PRINT a
+90 RESTORE:READ a:PRINT a
+91 DIM m(2,2):m(1,2)=9
+92 RESTORE 130:READ a,b:PRINT a;" ";b
+95 END
+100 DATA 1,"two,three",INSTR("a,b","b")
+110 PRINT "skip":DATA 6,7:PRINT "skip"
+120 &more:DATA 8
+130 DATA m(1,2),5
@@ -0,0 +1,16 @@
+10 a=3:b=4:c=-2
+20 PRINT a+b*c
+30 PRINT -a*b
+40 PRINT -a^2
+50 PRINT 2^3^2
+60 PRINT (a+b)*c
+70 PRINT a-b-c
+80 PRINT 17 MOD 5
+90 PRINT 1<<4
+100 PRINT a<b
+110 PRINT NOT 0
+120 PRINT (a=3) AND (b=4)
+130 PRINT 5 OR 2
+140 PRINT 6 EOR 3
+150 PRINT a*(b-(c+1))
+160 FOR i=1 TO 3:s=s+i*i:NEXT:PRINT s
@@ -0,0 +1,11 @@
+10 ' string and numeric arguments evaluated into the argument stack
+20 ' must survive calls made while evaluating later arguments
+30 GOTO 1000
+100 PROC cat(a$,b$,n)
+110 RETURN @n,@a$+"-"+@b$
+200 PROC up(s$):RETURN 0,@s$+"!"
+300 PROC twice(x):@l=@x*2:RETURN FN sq(@l)+@x
+400 PROC sq(y):RETURN @y*@y
+1000 CALL cat("a",RET$(FN up("b")),FN twice(3))
+1010 PRINT RET$(0);" ";RET(0)
+1020 PRINT FN twice(FN twice(1))
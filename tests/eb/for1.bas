@@ -0,0 +1,8 @@
+10 ' FOR loops with counted and uncounted iterations
+20 FOR i=7 TO -6 STEP -3:PRINT i;" ";:NEXT i:PRINT i
+30 FOR i=10 TO 1:PRINT i;" ";:NEXT:PRINT i
+40 FOR i=1 TO 2 STEP 0.5:PRINT i;" ";:NEXT i:PRINT i
+50 FOR i=1 TO 10:IF i=3 THEN i=8
+60 PRINT i;" ";:NEXT i:PRINT i
+70 n=0:FOR i=1 TO 3:FOR j=1 TO 4:n=n+1:NEXT j:NEXT i:PRINT n;" ";i;" ";j
+80 FOR k%=1 TO 5 STEP 2:PRINT k%;" ";:NEXT k%:PRINT k%
@@ -0,0 +1,19 @@
+10 a%=7.9:b%=-7.9
+20 PRINT a%;" ";b%
+30 PRINT a%*b%+3
+40 PRINT a%/2
+50 PRINT a% MOD 4;" ";a% AND 3;" ";NOT a%
+60 DIM t%(3)=[10,20,30,40]
+70 FOR i%=0 TO 3:s%=s%+t%(i%):NEXT i%
+80 PRINT s%;" ";i%
+90 n%=0:FOR i%=10 TO 1 STEP -3:n%=n%*100+i%:NEXT:PRINT n%
+100 x%=5:x%=x%*2.6:PRINT x%
+110 PRINT 3*a%=21;" ";a%<b%
+130 READ d%,t%(1):PRINT d%;" ";t%(1)
+140 DATA 42.7,-3
+150 c%=&HFF:PRINT c% AND &H0F;" ";c% EOR 1
+160 FOR i%=1 TO 10:IF i%=4 THEN EXIT FOR i%
+170 NEXT i%:PRINT i%
+180 n%=0:FOR i%=2147483640 TO 2147483647:n%=n%+1:NEXT i%:PRINT n%;" ";i%
+190 n%=0:FOR i%=0 TO 3 STEP 0.5:n%=n%+1:NEXT i%:PRINT n%;" ";i%
+200 a%=5000000000.5:b%=-5000000000:c%=2^63+4096:PRINT a%;" ";b%;" ";c%
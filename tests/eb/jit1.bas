@@ -0,0 +1,17 @@
+10 CONFIG 15,2
+20 FOR i=1 TO 5
+30 PRINT FN sq(i);" ";FN fac(i)
+40 NEXT
+50 CONFIG 15,0
+60 END
+100 PROC sq(x)
+110 @s=0
+120 FOR @j=1 TO @x:@s=@s+@j*@j:NEXT
+130 RETURN @s
+200 PROC fac(x)
+210 @r=1
+220 WHILE @x>1
+230 @r=@r*@x:@x=@x-1
+240 WEND
+250 IF @r>100 THEN RETURN -1
+260 RETURN @r
@@ -0,0 +1,18 @@
+5 start=TICK()
+10 FOR i=0 TO 9999
+20   APPEND ~l,i
+30 NEXT i
+40 s=0
+50 FOR i=0 TO LEN(~l)-1
+60   s=s+~l(i)
+70 NEXT i
+80 ?s/1000
+90 FOR i=1 TO LEN(~l)
+100   PREPEND ~l,POPB(~l)
+110 NEXT i
+120 ?~l(0);" ";~l(9999)
+130 IF TICK()-start<2000 THEN
+140   PRINT "good enough"
+150 ELSE
+160   PRINT "performance regression"
+170 ENDIF
@@ -0,0 +1,17 @@
+10 ' packed arrays and whole-array operations
+20 DIM a(9) AS BYTE
+30 a(0)=130:PRINT a(0)
+40 MAT a()=3
+50 MAT a()=a()*50
+60 PRINT a(9);" ";MATSUM(a())
+70 DIM f(15) AS FLOAT
+80 FOR i=0 TO 15:f(i)=i-5:NEXT i
+90 PRINT MATMIN(f());" ";MATMAX(f());" ";MATSUM(f())
+100 DIM g(15)
+110 MAT g()=f()+f()
+120 MAT g(1)=g(),5
+130 PRINT g(0);" ";g(5);" ";g(6)
+140 PRINT MATSUM(g(),3)
+150 word$="w":long=2:DIM byte(1) AS LONG:byte(1)=long*3
+160 PRINT word$;" ";byte(1)
+170 DIM w(0) AS WORD:w(0)=5000000000:PRINT w(0)
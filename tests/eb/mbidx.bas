@@ -0,0 +1,6 @@
+10 ' long multibyte strings through the character index
+20 FOR i=1 TO 100:a$=a$+"あい":NEXT i
+30 s=0:FOR i=0 TO LEN(a$)-1:s=s+ASC(MID$(a$,i,1)):NEXT i
+40 PRINT LEN(a$);" ";s
+50 a$=a$+"x":PRINT LEN(a$);" ";RIGHT$(a$,3)
+60 a$="x"+a$:PRINT MID$(a$,1,2);" ";LEN(a$);" ";MID$(a$,200,5)
@@ -0,0 +1,8 @@
+10 ' short and long strings passed through assignments and lists
+20 a$="short":b$=a$+" and a much longer tail"
+30 c$=b$:b$=LEFT$(b$,3)
+40 PRINT a$;"|";b$;"|";c$
+50 APPEND ~l$,a$:APPEND ~l$,c$:PREPEND ~l$,b$
+60 PRINT ~l$(0);"|";~l$(1);"|";~l$(2)
+70 FOR i=1 TO 20:d$=d$+CHR$(64+i):NEXT i
+80 PRINT d$;" ";LEN(d$)
@@ -0,0 +1,9 @@
+10 ' string accumulation appends in place
+20 FOR i=1 TO 10000:a$=a$+"ab"+CHR$(48+i MOD 10):NEXT i
+30 PRINT LEN(a$);" ";RIGHT$(a$,6)
+40 b$="x":b$=b$+"y"+b$:PRINT b$
+50 c$="1":c$=c$+STR$(FN f()):PRINT c$
+60 END
+70 PROC f
+80 c$="changed"
+90 RETURN 2
@@ -118,9 +118,10 @@ BString::BString(double value, unsigned char decimalPlaces) {
 }
 
 BString::~BString() {
-    if(buffer) {
+    if(buffer && !isInline()) {
         free(buffer);
     }
+    invalidateMB();
     init();
 }
 
@@ -132,11 +133,13 @@ inline void BString::init(void) {
     buffer = NULL;
     capacity = 0;
     len = 0;
+    mb_index = NULL;
 }
 
 void BString::invalidate(void) {
-    if(buffer)
+    if(buffer && !isInline())
         free(buffer);
+    invalidateMB();
     init();
 }
 
@@ -152,6 +155,13 @@ unsigned char BString::reserve(unsigned int size) {
 }
 
 unsigned char BString::changeBuffer(unsigned int maxStrLen) {
+    if(!buffer && maxStrLen < BSTRING_INLINE_SIZE) {
+        memset(inline_buffer, 0, BSTRING_INLINE_SIZE);
+        buffer = inline_buffer;
+        capacity = BSTRING_INLINE_SIZE - 1;
+        return 1;
+    }
+
     size_t newSize = (maxStrLen + 16) & (~0xf);
     char *newbuffer = NULL;
 #ifdef ESP8266
@@ -161,7 +171,15 @@ unsigned char BString::changeBuffer(unsigned int maxStrLen) {
       // Weirdly enough, this does not seem to happen in variable.h, for
       // example.
 #endif
-    newbuffer = (char *) realloc(buffer, newSize);
+    {
+        if(isInline()) {
+            newbuffer = (char *) malloc(newSize);
+            if(newbuffer)
+                memcpy(newbuffer, inline_buffer, BSTRING_INLINE_SIZE);
+        } else {
+            newbuffer = (char *) realloc(buffer, newSize);
+        }
+    }
     if(newbuffer) {
         size_t oldSize = capacity + 1; // include NULL.
         if (newSize > oldSize)
@@ -182,6 +200,7 @@ unsigned char BString::changeBuffer(unsigned int maxStrLen) {
 // /*********************************************/
 
 BString & BString::copy(const char *cstr, unsigned int length) {
+    invalidateMB();
     if(!reserve(length)) {
         invalidate();
         return *this;
@@ -193,6 +212,7 @@ BString & BString::copy(const char *cstr, unsigned int length) {
 }
 
 BString & BString::copy(const __FlashStringHelper *pstr, unsigned int length) {
+    invalidateMB();
     if (!reserve(length)) {
         invalidate();
         return *this;
@@ -204,24 +224,31 @@ BString & BString::copy(const __FlashStringHelper *pstr, unsigned int length) {
 }
 
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
+// Takes over the contents of rhs, leaving it empty. Heap buffers change
+// owners; inline strings have to be copied.
 void BString::move(BString &rhs) {
-    if(buffer) {
-        if(capacity >= rhs.len) {
-            memcpy(buffer, rhs.buffer, rhs.len);
-            buffer[rhs.len] = 0;
-            len = rhs.len;
-            rhs.len = 0;
-            return;
-        } else {
-            free(buffer);
-        }
+    invalidateMB();
+    if(!rhs.buffer) {
+        invalidate();
+        return;
     }
+    if(rhs.isInline()) {
+        if(!buffer)
+            changeBuffer(rhs.len);
+        memcpy(buffer, rhs.buffer, rhs.len + 1);
+        len = rhs.len;
+        rhs.len = 0;
+        rhs.buffer[0] = 0;
+        return;
+    }
+    if(buffer && !isInline())
+        free(buffer);
     buffer = rhs.buffer;
     capacity = rhs.capacity;
     len = rhs.len;
-    rhs.buffer = NULL;
-    rhs.capacity = 0;
-    rhs.len = 0;
+    mb_index = rhs.mb_index;
+    rhs.init();
+    rhs.changeBuffer(0);
 }
 #endif
 
@@ -282,8 +309,18 @@ unsigned char BString::concat(const char *cstr, unsigned int length) {
         return 0;
     if(length == 0)
         return 1;
+    invalidateMB();
+    // cstr may point into our own buffer, which can move when growing.
+    bool self = buffer && cstr >= buffer && cstr <= buffer + len;
+    unsigned int self_offset = self ? cstr - buffer : 0;
+    // Grow geometrically so that building a string piece by piece takes
+    // linear time.
+    if(buffer && newlen > capacity && capacity * 2 > newlen)
+        reserve(capacity * 2);
     if(!reserve(newlen))
         return 0;
+    if(self)
+        cstr = buffer + self_offset;
     memcpy(buffer + len, cstr, length);
     buffer[newlen] = 0;
     len = newlen;
@@ -349,6 +386,7 @@ unsigned char BString::concat(const __FlashStringHelper * str) {
     if (!str) return 0;
     int length = strlen_P((PGM_P)str);
     if (length == 0) return 1;
+    invalidateMB();
     unsigned int newlen = len + length;
     if (!reserve(newlen)) return 0;
     strcpy_P(buffer + len, (PGM_P)str);
@@ -530,12 +568,14 @@ char BString::charAt(unsigned int loc) const {
 }
 
 void BString::setCharAt(unsigned int loc, char c) {
+    invalidateMB();
     if(loc < len)
         buffer[loc] = c;
 }
 
 char & BString::operator[](unsigned int index) {
     static char dummy_writable_char;
+    invalidateMB();
     if(index >= len || !buffer) {
         // XXX: extend buffer instead
         dummy_writable_char = 0;
@@ -551,15 +591,70 @@ char BString::operator[](unsigned int index) const {
 }
 
 utf8_int32_t BString::codepointAt(unsigned int index) const {
-    char *start = buffer;
-    while (start && *start && index--) {
-        start += utf8codepointcalcsize(start);
-    }
     utf8_int32_t c;
-    utf8codepoint(start, &c);
+    utf8codepoint(buffer + offsetMB(index), &c);
     return c;
 }
 
+// /*********************************************/
+// /*  Multibyte Index                          */
+// /*********************************************/
+
+// Returns the code point index of the string, building it if necessary,
+// or NULL if the string is too short to need one.
+const unsigned int *BString::indexMB(void) const {
+    if(mb_index || !buffer || len < BSTRING_MB_INDEX_MIN)
+        return mb_index;
+
+    unsigned int *idx = (unsigned int *)
+        malloc((len / BSTRING_MB_INDEX_STEP + 3) * sizeof(unsigned int));
+    if(!idx)
+        return NULL;
+
+    const char *p = buffer;
+    const char *e = buffer + len;
+    unsigned int count = 0;
+    while(p < e && *p) {
+        if(count % BSTRING_MB_INDEX_STEP == 0)
+            idx[2 + count / BSTRING_MB_INDEX_STEP] = p - buffer;
+        p += utf8codepointcalcsize(p);
+        count++;
+    }
+    idx[0] = count;
+    idx[1] = (p < e ? p : e) - buffer;
+
+    mb_index = idx;
+    return mb_index;
+}
+
+unsigned int BString::lengthMB(void) const {
+    if(!buffer)
+        return 0;
+    const unsigned int *idx = indexMB();
+    if(idx)
+        return idx[0];
+    return utf8len(buffer);
+}
+
+// Returns the byte offset of the code point with the given index, or of
+// the end of the string if there are not that many code points.
+unsigned int BString::offsetMB(unsigned int index) const {
+    if(!buffer)
+        return 0;
+    const char *start = buffer;
+    const unsigned int *idx = indexMB();
+    if(idx) {
+        if(index >= idx[0])
+            return idx[1];
+        start += idx[2 + index / BSTRING_MB_INDEX_STEP];
+        index %= BSTRING_MB_INDEX_STEP;
+    }
+    while(*start && index--) {
+        start += utf8codepointcalcsize(start);
+    }
+    return start - buffer;
+}
+
 void BString::getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index) const {
     if(!bufsize || !buf)
         return;
@@ -663,20 +758,14 @@ BString BString::substringMB(unsigned int left, unsigned int right) const {
         left = temp;
     }
     BString out;
-    if(left >= utf8len(buffer))
+    unsigned int count = lengthMB();
+    if(left >= count)
         return out;
-    if(right > utf8len(buffer))
-        right = utf8len(buffer);
+    if(right > count)
+        right = count;
 
-    char *start = buffer;
-    for (int i = 0; i < left && start && *start; ++i) {
-        start += utf8codepointcalcsize(start);
-    }
-    char *end = start;
-    for (int i = 0; i < right - left && end && *end; ++i) {
-        end += utf8codepointcalcsize(end);
-    }
-    out.copy(start, end - start);
+    unsigned int start = offsetMB(left);
+    out.copy(buffer + start, offsetMB(right) - start);
     return out;
 }
 
@@ -685,6 +774,7 @@ BString BString::substringMB(unsigned int left, unsigned int right) const {
 // /*********************************************/
 
 void BString::replace(char find, char replace) {
+    invalidateMB();
     if(!buffer)
         return;
     unsigned int c = 0;
@@ -695,6 +785,7 @@ void BString::replace(char find, char replace) {
 }
 
 void BString::replace(const BString& find, const BString& replace) {
+    invalidateMB();
     if(len == 0 || find.len == 0)
         return;
     int diff = replace.len - find.len;
@@ -749,6 +840,7 @@ void BString::remove(unsigned int index) {
 }
 
 void BString::remove(unsigned int index, unsigned int count) {
+    invalidateMB();
     if(index >= len) {
         return;
     }
@@ -765,6 +857,7 @@ void BString::remove(unsigned int index, unsigned int count) {
 }
 
 void BString::toLowerCase(void) {
+    invalidateMB();
     if(!buffer)
         return;
     char *p;
@@ -775,6 +868,7 @@ void BString::toLowerCase(void) {
 }
 
 void BString::toUpperCase(void) {
+    invalidateMB();
     if(!buffer)
         return;
     char *p;
@@ -785,6 +879,7 @@ void BString::toUpperCase(void) {
 }
 
 void BString::trim(void) {
+    invalidateMB();
     if(!buffer || len == 0)
         return;
     char *begin = buffer;
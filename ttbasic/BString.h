@@ -32,6 +32,16 @@
 #include <utf8.h>
 #include "ttconfig.h"
 
+// Strings of up to BSTRING_INLINE_SIZE - 1 bytes are stored in the object
+// itself instead of on the heap.
+#define BSTRING_INLINE_SIZE 16
+
+// Strings of at least BSTRING_MB_INDEX_MIN bytes get an index of the byte
+// offsets of every BSTRING_MB_INDEX_STEP-th code point the first time a
+// multibyte-aware method needs it. It is discarded whenever the string is
+// modified.
+#define BSTRING_MB_INDEX_MIN  64
+#define BSTRING_MB_INDEX_STEP 32
 
 // An inherited class for holding the result of a concatenation.  These
 // result objects are assumed to be writable by subsequent concatenations.
@@ -85,6 +95,7 @@ class BString {
         ~BString(void);
 
         int fromBasic(EB_TOKEN_TYPE *s) {
+          invalidateMB();
           len = *s++;
           if (!reserve(len)) {
             invalidate();
@@ -108,13 +119,9 @@ class BString {
                 return 0;
             }
         }
-        inline unsigned int lengthMB(void) const {
-            if (buffer)
-                return utf8len(buffer);
-            else
-                return 0;
-        }
+        unsigned int lengthMB(void) const;
         inline void resetLength(unsigned int size) {
+            invalidateMB();
             len = size;
         }
 
@@ -244,8 +251,9 @@ class BString {
             getBytes((unsigned char *) buf, bufsize, index);
         }
         const char* c_str() const { return buffer; }
-        char* begin() { return buffer; }
-        char* end() { return buffer + length(); }
+        // Writing through these discards the multibyte index.
+        char* begin() { invalidateMB(); return buffer; }
+        char* end() { invalidateMB(); return buffer + length(); }
         const char* begin() const { return c_str(); }
         const char* end() const { return c_str() + length(); }
 
@@ -264,7 +272,7 @@ class BString {
         ;
         BString substring(unsigned int beginIndex, unsigned int endIndex) const;
         BString substringMB(unsigned int beginIndex) const {
-            return substringMB(beginIndex, utf8len(buffer));
+            return substringMB(beginIndex, lengthMB());
         }
         ;
         BString substringMB(unsigned int beginIndex, unsigned int endIndex) const;
@@ -286,9 +294,25 @@ class BString {
         char *buffer;	        // the actual char array
         unsigned int capacity;  // the array length minus one (for the '\0')
         unsigned int len;       // the BString length (not counting the '\0')
+        char inline_buffer[BSTRING_INLINE_SIZE];
+        // [0]: number of code points, [1]: byte offset of the end of the
+        // last one, [2 + n]: byte offset of code point
+        // n * BSTRING_MB_INDEX_STEP
+        mutable unsigned int *mb_index;
     protected:
         void init(void);
         void invalidate(void);
+        inline void invalidateMB(void) {
+            if (mb_index) {
+                free(mb_index);
+                mb_index = NULL;
+            }
+        }
+        const unsigned int *indexMB(void) const;
+        unsigned int offsetMB(unsigned int index) const;
+        inline bool isInline(void) const {
+            return buffer == inline_buffer;
+        }
         unsigned char changeBuffer(unsigned int maxStrLen);
         unsigned char concat(const char *cstr, unsigned int length);
 
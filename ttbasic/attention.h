@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2023 Ulrich Hecht
+
+#ifndef _ATTENTION_H
+#define _ATTENTION_H
+
+// Set asynchronously (frame timer, input polling timer, audio engine)
+// whenever process_events() has something to do. The interpreter only
+// checks this flag after each statement and leaves everything else to
+// process_events().
+extern volatile bool attention_needed;
+
+// Platforms that cannot raise the flag asynchronously keep it set
+// permanently, which amounts to polling after every statement.
+#if defined(HOSTED) || defined(__DJGPP__)
+#define ATTENTION_ALWAYS
+#endif
+
+static inline void request_attention(void) {
+  attention_needed = true;
+}
+
+#endif
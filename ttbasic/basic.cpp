@@ -21,6 +21,7 @@
 #include "eb_img.h"
 #include "eb_input.h"
 #include "eb_sys.h"
+#include "timing.h"
 
 #include "epigrams.h"
 
@@ -69,15 +70,6 @@
 #include "basic.h"
 #include "net.h"
 
-// size by which the list buffer is incremented when full
-#define LISTBUF_INC 128
-
-struct unaligned_num_t {
-  num_t n;
-} __attribute__((packed));
-
-#define UNALIGNED_NUM_T(ip) (reinterpret_cast<struct unaligned_num_t *>(ip)->n)
-
 // Definition of TOYOSHIKI TinyBASIC program usage area
 
 // *** SD card management *****************
@@ -360,25 +352,6 @@ char lbuf[SIZE_LINE];  // Command input buffer
 char tbuf[SIZE_LINE];  // Text display buffer
 int32_t tbuf_pos = 0;
 
-// BASIC line number descriptor.
-// NB: A lot of code relies on next being the first element.
-typedef struct {
-#ifdef LOWMEM
-  uint8_t  next;
-#else
-  uint32_t next;
-#endif
-  union {
-    num_t raw_line;
-    struct {
-      uint32_t line;
-      int8_t indent;
-    };
-  };
-} __attribute__((packed)) line_desc_t;
-
-#define icodes_per_line_desc() (sizeof(line_desc_t) / sizeof(icode_t))
-
 Basic *bc = NULL;
 
 // メモリへの文字出力
@@ -589,39 +562,101 @@ BString getstr(uint8_t eoi) {
   return BString(lbuf);
 }
 
+// Keyword trie, built from kwtbl on first use and rebuilt whenever native
+// modules have added keywords.
+struct kw_node_t {
+  char c;           // (upper-case) character leading to this node
+  int32_t token;    // keyword ending at this node, or -1
+  int32_t child;    // first child node, or -1
+  int32_t sibling;  // next node with the same parent, or -1
+};
+static std::vector<kw_node_t> kw_trie;
+static int32_t kw_root[256];  // children of the root node by character
+static uint32_t kw_trie_size; // number of kwtbl entries in kw_trie
+
+static inline char kw_upcase(char c) {
+  return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+static void build_kw_trie() {
+  kw_trie.clear();
+  for (int i = 0; i < 256; ++i)
+    kw_root[i] = -1;
+
+  for (uint32_t i = 0; i < kwtbl.size(); ++i) {
+    if (!kwtbl[i] || !*kwtbl[i])
+      continue;
+
+    int32_t n = -1;  // parent node, -1 for the root
+    for (const char *p = kwtbl[i]; *p; ++p) {
+      char c = kw_upcase(*p);
+      int32_t first = n < 0 ? kw_root[(uint8_t)c] : kw_trie[n].child;
+      int32_t ch;
+      for (ch = first; ch >= 0 && kw_trie[ch].c != c; ch = kw_trie[ch].sibling)
+        ;
+      if (ch < 0) {
+        kw_node_t node = { c, -1, -1, first };
+        ch = kw_trie.size();
+        kw_trie.push_back(node);
+        if (n < 0)
+          kw_root[(uint8_t)c] = ch;
+        else
+          kw_trie[n].child = ch;
+      }
+      n = ch;
+    }
+
+    // Earlier entries take precedence, same as with a linear search.
+    if (kw_trie[n].token < 0)
+      kw_trie[n].token = i;
+  }
+
+  kw_trie_size = kwtbl.size();
+}
+
 // キーワード検索
 //[戻り値]
 //  該当なし   : -1
 //  見つかった : キーワードコード
+//
+// Returns the first keyword in kwtbl that matches, just like a linear
+// search through the table would.
 int lookup(char *str) {
-  for (uint32_t i = 0; i < kwtbl.size(); ++i) {
-    if (kwtbl[i]) {
-      int l = strlen_P(kwtbl[i]);
-
-      if (strncasecmp_P(str, kwtbl[i], l))
-        continue;
-
-      // Don't match if
-      // - keyword separation is not optional, and
-      // - the keyword ends in a letter, and
-      // - the keyword is not ELSE (to allow "ELSEIF"), and
-      // - the keyword is not FN, and
-      // - the character after the keyword is valid in an identifier.
-
-      // NB: There are keywords other than FN that ECMA BASIC-2 does not
-      // allow in identifiers, but they are extremely arbitrary and have
-      // therefore been omitted here.
-      // FN is here because there are tests relying on it being glued to
-      // function identifiers.
-      if (!CONFIG.keyword_sep_optional && isAlpha(str[l - 1]) &&
+  if (kw_trie_size != kwtbl.size())
+    build_kw_trie();
+
+  int found = -1;
+  int32_t n = kw_root[(uint8_t)kw_upcase(*str)];
+
+  for (int l = 1; n >= 0; ++l) {
+    int i = kw_trie[n].token;
+
+    // Don't match if
+    // - keyword separation is not optional, and
+    // - the keyword ends in a letter, and
+    // - the keyword is not ELSE (to allow "ELSEIF"), and
+    // - the keyword is not FN, and
+    // - the character after the keyword is valid in an identifier.
+
+    // NB: There are keywords other than FN that ECMA BASIC-2 does not
+    // allow in identifiers, but they are extremely arbitrary and have
+    // therefore been omitted here.
+    // FN is here because there are tests relying on it being glued to
+    // function identifiers.
+    if (i >= 0 && (found < 0 || i < found) &&
+        !(!CONFIG.keyword_sep_optional && isAlpha(str[l - 1]) &&
           i != I_ELSE && i != I_FN &&
-          (isAlphaNumeric(str[l]) || str[l] == '_'))
-        continue;
+          (isAlphaNumeric(str[l]) || str[l] == '_')))
+      found = i;
 
-      return i;
-    }
+    if (!str[l])
+      break;
+    char c = kw_upcase(str[l]);
+    for (n = kw_trie[n].child; n >= 0 && kw_trie[n].c != c;
+         n = kw_trie[n].sibling)
+      ;
   }
-  return -1;
+  return found;
 }
 
 uint8_t parse_identifier(char *ptok, char *vname) {
@@ -664,6 +699,7 @@ unsigned int BASIC_INT SMALL Basic::toktoi(bool find_prg_text) {
 
   bool is_prg_text = false;
   bool is_require = false;
+  bool after_as = false;
 
   while (*s) {           //文字列1行分の終端まで繰り返す
     while (isspace(*s))  //空白を読み飛ばす
@@ -679,6 +715,12 @@ unsigned int BASIC_INT SMALL Basic::toktoi(bool find_prg_text) {
 
     bool isext = false;
     key = lookup(s);
+    // Array element types are only keywords after AS, so that existing
+    // programs can keep using them as variable names.
+    if ((key == I_BYTE || key == I_WORD || key == I_LONG ||
+         key == I_FLOAT) && !after_as)
+      key = -1;
+    after_as = key == I_AS;
     if (key < 0) {
     } else {
       s += strlen_P(kwtbl[key]);
@@ -1012,6 +1054,29 @@ as local variables or arguments.
           goto oom;
         s += var_len + 1;
         ptok++;
+      } else if (*p == '%') {
+        // Integer variables are global only.
+        if (is_local || is_list) {
+          err = ERR_NOT_SUPPORTED;
+          return 0;
+        }
+        int idx;
+        bool is_array = p[1] == '(';
+        if (is_array) {
+          ibuf[len++] = I_IVARARR;
+          idx = int_arr_names.assign(vname, is_prg_text);
+        } else {
+          ibuf[len++] = I_IVAR;
+          idx = int_var_names.assign(vname, is_prg_text);
+        }
+        if (idx < 0)
+          goto oom;
+        ibuf[len++] = idx;
+        if ((is_array && int_arr.reserve(int_arr_names.varTop())) ||
+            (!is_array && int_var.reserve(int_var_names.varTop())))
+          goto oom;
+        s += var_len + 1 + is_array;
+        ptok += 1 + is_array;
       } else if (*p == '(') {
         if (is_local) {
           err = ERR_NOT_SUPPORTED;
@@ -1092,12 +1157,17 @@ oom:
 
 // Return free memory size
 int Basic::list_free() {
-  icode_t *lp;
+  if (list_end < 0) {
+    icode_t *lp;
 
-  // Move the pointer to the end of the list
-  for (lp = listbuf; *lp; lp += *lp) {}
+    // Move the pointer to the end of the list
+    list_last_line = 0;
+    for (lp = listbuf; *lp; lp += *lp)
+      list_last_line = getlineno(lp);
+    list_end = lp - listbuf;
+  }
 
-  return listbuf + size_list - lp - 1;  // Calculate the rest and return it
+  return size_list - list_end - 1;  // Calculate the rest and return it
 }
 
 // Get line numbere by line pointer
@@ -1108,30 +1178,78 @@ uint32_t BASIC_FP getlineno(icode_t *lp) {
   return ld->line;
 }
 
+// Build the line number index from the program in listbuf.
+void Basic::build_line_index() {
+  icode_t *lp;
+
+  line_index.clear();
+  for (lp = listbuf; *lp; lp += *lp) {
+    line_index_t li = { getlineno(lp), (uint32_t)(lp - listbuf) };
+    line_index.push_back(li);
+  }
+  line_index_end = lp - listbuf;
+  line_index_valid = true;
+}
+
+// Find the index of the first line with a line number equal to or larger
+// than lineno. Returns the number of lines if there is no such line.
+uint32_t BASIC_FP Basic::find_line_index(uint32_t lineno) {
+  if (!line_index_valid)
+    build_line_index();
+
+  uint32_t lo = 0, hi = line_index.size();
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (line_index[mid].line < lineno)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
 // Search line by line number
 icode_t *BASIC_FP Basic::getlp(uint32_t lineno) {
-  icode_t *lp;  //ポインタ
-
-  for (lp = listbuf; *lp; lp += *lp)  // Repeat from top to bottom
-    if (getlineno(lp) >= lineno)
-      break;
+  uint32_t i = find_line_index(lineno);
+  if (i >= line_index.size())
+    return listbuf + line_index_end;  // end of program
 
-  return lp;  //ポインタを持ち帰る
+  return listbuf + line_index[i].offset;
 }
 
 // Get line index from line number
 uint32_t Basic::getlineIndex(uint32_t lineno) {
-  icode_t *lp;  //ポインタ
-  uint32_t index = 0;
-  uint32_t rc = INT32_MAX;
-  for (lp = listbuf; *lp; lp += *lp) {  // 先頭から末尾まで繰り返す
-    if (getlineno(lp) >= lineno) {      // もし指定の行番号以上なら
-      rc = index;
-      break;  // 繰り返しを打ち切る
-    }
-    index++;
+  uint32_t i = find_line_index(lineno);
+  if (i >= line_index.size())
+    return INT32_MAX;
+
+  return i;
+}
+
+uint64_t BASIC_FP Basic::jump_key(icode_t *p, int kind, uint32_t extra) {
+  return ((uint64_t)(p - listbuf) << 32) | ((uint64_t)kind << 28) |
+         (extra & 0x0fffffff);
+}
+
+// Look up a cached jump target. On success, clp is set to the target line
+// (and cip to its start if that is a different line, just like the block
+// searches do) and the target token pointer is returned.
+icode_t *BASIC_FP Basic::find_jump(uint64_t key) {
+  auto it = jump_cache.find(key);
+  if (it == jump_cache.end())
+    return NULL;
+  icode_t *lp = listbuf + it->second.lp;
+  if (lp != clp) {
+    clp = lp;
+    cip = clp + icodes_per_line_desc();
   }
-  return rc;
+  return listbuf + it->second.ip;
+}
+
+// Remember the jump target ip located in the current line clp.
+void Basic::add_jump(uint64_t key, icode_t *ip) {
+  jump_target_t t = { (uint32_t)(clp - listbuf), (uint32_t)(ip - listbuf) };
+  jump_cache[key] = t;
 }
 
 // ELSE中間コードをサーチする
@@ -1146,6 +1264,15 @@ icode_t *BASIC_INT Basic::getELSEptr(icode_t *p, bool endif_only, int adjust) {
   icode_t *stlp = clp;
   icode_t *stip = cip;
 
+  bool cacheable = in_listbuf(p);
+  uint64_t key = 0;
+  if (cacheable) {
+    key = jump_key(p, endif_only ? JUMP_ENDIF : JUMP_ELSE, adjust & 0xff);
+    rc = find_jump(key);
+    if (rc)
+      return rc;
+  }
+
   // ブログラム中のGOTOの飛び先行番号を付け直す
   for (lp = p;;) {
     switch (*lp) {
@@ -1193,6 +1320,8 @@ icode_t *BASIC_INT Basic::getELSEptr(icode_t *p, bool endif_only, int adjust) {
     }
   }
 DONE:
+  if (cacheable)
+    add_jump(key, rc);
   return rc;
 }
 
@@ -1201,6 +1330,15 @@ icode_t *BASIC_INT Basic::getWENDptr(icode_t *p) {
   icode_t *lp;
   index_t lifstki = 1;
 
+  bool cacheable = in_listbuf(p);
+  uint64_t key = 0;
+  if (cacheable) {
+    key = jump_key(p, JUMP_WEND, 0);
+    rc = find_jump(key);
+    if (rc)
+      return rc;
+  }
+
   for (lp = p;;) {
     switch (*lp) {
     case I_WHILE:
@@ -1234,6 +1372,8 @@ icode_t *BASIC_INT Basic::getWENDptr(icode_t *p) {
     }
   }
 DONE:
+  if (cacheable)
+    add_jump(key, rc);
   return rc;
 }
 
@@ -1269,7 +1409,10 @@ void Basic::inslist() {
   // when only line numbers are entered when there is insufficient space ..)
   // @Tamakichi)
   if (list_free() < (int)*ibuf) {  // If the vacancy is insufficient
-    int inc_mem = (*ibuf + LISTBUF_INC - 1) / LISTBUF_INC * LISTBUF_INC;
+    // Grow geometrically to avoid reallocating for every line when
+    // loading large programs.
+    int inc_mem = std::max((int)*ibuf, size_list / 2);
+    inc_mem = (inc_mem + LISTBUF_INC - 1) / LISTBUF_INC * LISTBUF_INC;
     listbuf = (icode_t *)realloc(listbuf, (size_list + inc_mem) * sizeof(icode_t));
     if (!listbuf) {
       err = ERR_OOM;
@@ -1285,7 +1428,24 @@ void Basic::inslist() {
   ld->line = lin;
   ld->indent = 0;
 
-  insp = getlp(getlineno(ibuf));  // 挿入位置ポインタを取得
+  uint32_t lineno = getlineno(ibuf);
+  int32_t end = list_end;
+  invalidate_program_index();
+
+  // Lines arriving in order (the common case when loading a program) are
+  // simply appended.
+  if (end == 0 || lineno > list_last_line) {
+    if (*ibuf != icodes_per_num() + 2) {
+      memcpy(listbuf + end, ibuf, *ibuf * sizeof(icode_t));
+      end += *ibuf;
+      listbuf[end] = 0;
+      list_last_line = lineno;
+    }
+    list_end = end;
+    return;
+  }
+
+  insp = getlp(lineno);  // 挿入位置ポインタを取得
 
   // 同じ行番号の行が存在したらとりあえず削除
   if (getlineno(insp) == getlineno(ibuf)) {  // もし行番号が一致したら
@@ -1501,6 +1661,24 @@ int SMALL Basic::putlist(icode_t *ip, uint8_t devno) {
       }
       sc0.setColor(COL(FG), COL(BG));
       c_putch('(', devno);
+    } else if (*ip == I_IVAR) {
+      ip++;
+      var_code = *ip++;
+      sc0.setColor(COL(VAR), COL(BG));
+      c_puts(int_var_names.name(var_code), devno);
+      c_putch('%', devno);
+      sc0.setColor(COL(FG), COL(BG));
+
+      if (!nospaceb((token_t)*ip))
+        c_putch(' ', devno);
+    } else if (*ip == I_IVARARR) {
+      ip++;
+      var_code = *ip++;
+      sc0.setColor(COL(VAR), COL(BG));
+      c_puts(int_arr_names.name(var_code), devno);
+      c_putch('%', devno);
+      sc0.setColor(COL(FG), COL(BG));
+      c_putch('(', devno);
     } else if (*ip == I_NUMLSTREF) {
       ip++;
       var_code = *ip++;
@@ -1649,6 +1827,7 @@ void SMALL Basic::iinput() {
   num_t value;
   BString str_value;
   short index;  // Array subscript or variable number
+  icode_t vtok;
   int32_t filenum = -1;
   uint8_t eoi;  // end-of-input character
 
@@ -1679,12 +1858,15 @@ void SMALL Basic::iinput() {
     case I_VAR:
     case I_VARARR:
     case I_NUMLST:
+    case I_IVAR:
+    case I_IVARARR:
+      vtok = cip[-1];
       index = *cip++;
 
-      if (cip[-2] == I_VARARR) {
+      if (vtok == I_VARARR || vtok == I_IVARARR) {
         dims = get_array_dims(idxs);
         // XXX: check if dims matches array
-      } else if (cip[-2] == I_NUMLST) {
+      } else if (vtok == I_NUMLST) {
         if (get_array_dims(idxs) != 1) {
           SYNTAX_T(_("invalid list index"));
           return;
@@ -1722,8 +1904,12 @@ void SMALL Basic::iinput() {
       if (err)
         return;
 
-      if (dims > 0)
-        num_arr.var(index).var(dims, idxs) = value;
+      if (vtok == I_IVAR)
+        int_var.var(index) = basic_int(value);
+      else if (vtok == I_IVARARR)
+        int_arr.var(index).var(dims, idxs) = basic_int(value);
+      else if (dims > 0)
+        num_arr.var(index).set(dims, idxs, value);
       else if (dims < 0)
         num_lst.var(index).var(idxs[0]) = value;
       else
@@ -1817,6 +2003,8 @@ int BASIC_FP token_size(icode_t *code) {
   case I_STRARR:
   case I_STRLST:
   case I_STRLSTREF:
+  case I_IVAR:
+  case I_IVARARR:
   case I_CALL:
   case I_FN:
   case I_PROC:
@@ -1873,6 +2061,9 @@ void Basic::initialize_proc_pointers(void) {
   lp = listbuf;
   ip = NULL;
 
+  jit_reset();
+  profile_reset();
+
   for (int i = 0; i < procs.size(); ++i) {
     procs.proc(i).lp = NULL;
   }
@@ -1979,33 +2170,81 @@ void Basic::initialize_label_pointers(void) {
   }
 }
 
-bool BASIC_INT Basic::find_next_data() {
-  int next;
-
-  if (!data_lp) {
-    in_data = false;
-    data_ip = NULL;
-    if (*listbuf)
-      data_lp = listbuf;
-    else
-      return false;
-  }
-  if (!data_ip) {
-    data_ip = data_lp + icodes_per_line_desc();
+void Basic::build_data_index() {
+  data_index.clear();
+  for (icode_t *lp = listbuf; *lp; lp += *lp) {
+    icode_t *ip = lp + icodes_per_line_desc();
+    bool in_data = false;
+    int depth = 0;
+    for (int next; (next = token_size(ip)) > 0; ip += next) {
+      bool item = false;
+      if (*ip == I_DATA) {
+        in_data = true;
+        depth = 0;
+        item = true;
+      } else if (in_data) {
+        switch (*ip) {
+        case I_COLON: in_data = false; break;
+        case I_OPEN:
+        case I_SQOPEN:
+        // array elements include their opening parenthesis
+        case I_VARARR:
+        case I_IVARARR:
+        case I_STRARR:
+        case I_NUMLST:
+        case I_STRLST: ++depth; break;
+        case I_CLOSE:
+        case I_SQCLOSE: --depth; break;
+        case I_COMMA: item = depth == 0; break;
+        default: break;
+        }
+      }
+      if (item) {
+        data_item_t di = { getlineno(lp), (uint32_t)(lp - listbuf),
+                           (uint32_t)(ip - listbuf) };
+        data_index.push_back(di);
+      }
+    }
   }
+  data_index_valid = true;
+}
 
-  while (*data_ip != I_DATA && (!in_data || *data_ip != I_COMMA)) {
-    in_data = false;
-    next = token_size(data_ip);
-    if (next < 0) {
-      data_lp += *data_lp;
-      if (!*data_lp)
-        return false;
-      data_ip = data_lp + icodes_per_line_desc();
-    } else
-      data_ip += next;
+// Position the data pointer on the first DATA element at or after its
+// current location.
+bool BASIC_INT Basic::find_next_data() {
+  if (!data_index_valid) {
+    build_data_index();
+    data_pos = 0;
+  }
+
+  uint32_t pos = 0;
+  if (data_lp) {
+    uint32_t ip = (data_ip ? data_ip : data_lp + icodes_per_line_desc()) -
+                  listbuf;
+    pos = data_pos;
+    // Usually the next element is the one following the last one read;
+    // otherwise the data pointer has been moved by RESTORE.
+    if (pos > data_index.size() ||
+        (pos < data_index.size() && data_index[pos].ip < ip) ||
+        (pos > 0 && data_index[pos - 1].ip >= ip)) {
+      uint32_t lo = 0, hi = data_index.size();
+      while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (data_index[mid].ip < ip)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      pos = lo;
+    }
   }
-  in_data = true;
+
+  if (pos >= data_index.size())
+    return false;
+
+  data_lp = listbuf + data_index[pos].lp;
+  data_ip = listbuf + data_index[pos].ip;
+  data_pos = pos + 1;
   return true;
 }
 
@@ -2106,6 +2345,33 @@ void BASIC_INT Basic::iread() {
       nvar.var(*cip++) = value;
       break;
 
+    case I_IVAR:
+      value = data_exp();
+      if (err)
+        return;
+      int_var.var(*cip++) = basic_int(value);
+      break;
+
+    case I_IVARARR: {
+      int idxs[MAX_ARRAY_DIMS];
+      int dims;
+
+      index = *cip++;
+      dims = get_array_dims(idxs);
+      if (dims < 0)
+        return;
+
+      value = data_exp();
+      if (err)
+        return;
+
+      int32_t &n = int_arr.var(index).var(dims, idxs);
+      if (err)
+        return;
+      n = basic_int(value);
+      break;
+    }
+
     case I_VARARR:
     case I_NUMLST: {
       bool is_list = cip[-1] == I_NUMLST;
@@ -2121,11 +2387,14 @@ void BASIC_INT Basic::iread() {
       if (err)
         return;
 
-      num_t &n = is_list ? num_lst.var(index).var(idxs[0]) :
-                           num_arr.var(index).var(dims, idxs);
-      if (err)
-        return;
-      n = value;
+      if (is_list) {
+        num_t &n = num_lst.var(index).var(idxs[0]);
+        if (err)
+          return;
+        n = value;
+      } else {
+        num_arr.var(index).set(dims, idxs, value);
+      }
       break;
     }
 
@@ -2197,8 +2466,25 @@ void Basic::irestore() {
     uint32_t line = iexp();
     if (err)
       return;
-    data_lp = getlp(line);
-    data_ip = data_lp + icodes_per_line_desc();
+    if (!data_index_valid)
+      build_data_index();
+    // Point directly at the first element in or after the given line.
+    uint32_t lo = 0, hi = data_index.size();
+    while (lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (data_index[mid].line < line)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    data_pos = lo;
+    if (data_pos < data_index.size()) {
+      data_lp = listbuf + data_index[data_pos].lp;
+      data_ip = listbuf + data_index[data_pos].ip;
+    } else {
+      list_free();
+      data_lp = data_ip = listbuf + list_end;
+    }
   }
 }
 
@@ -2240,8 +2526,9 @@ void Basic::clear_execution_state(bool clear) {
   lstki = 0;  // FORスタックインデクスを0に初期化
   astk_num_i = 0;
   astk_str_i = 0;
+  astk_num_pend = astk_str_pend = 0;
   data_lp = data_ip = NULL;
-  in_data = false;
+  data_pos = 0;
   if (clear)
     inew(NEW_VAR);
 }
@@ -2321,7 +2608,8 @@ void BASIC_FP Basic::irun(icode_t *start_clp, bool cont, bool clear,
     cip = clp + icodes_per_line_desc();  // 中間コードポインタを行番号の後ろに設定
 
   resume:
-    lp = iexe();  // 中間コードを実行して次の行の位置を得る
+    // 中間コードを実行して次の行の位置を得る
+    lp = iexe();
     if (err) {    // もしエラーを生じたら
       event_error_resume_lp = NULL;
       if (err == ERR_CHAIN) {
@@ -2450,12 +2738,14 @@ void Basic::isearch() {
 // Argument 0: all erase, 1: erase only program, 2: erase variable area only
 void Basic::inew(uint8_t mode) {
   data_ip = data_lp = NULL;
-  in_data = false;
+  data_pos = 0;
 
   if (mode != NEW_PROG) {
     nvar.reset();
+    int_var.reset();
     svar.reset();
     num_arr.reset();
+    int_arr.reset();
     num_lst.reset();
     str_arr.reset();
     str_lst.reset();
@@ -2471,8 +2761,12 @@ void Basic::inew(uint8_t mode) {
     svar.reserve(svar_names.varTop());
     nvar_names.deleteDirect();
     nvar.reserve(nvar_names.varTop());
+    int_var_names.deleteDirect();
+    int_var.reserve(int_var_names.varTop());
     num_arr_names.deleteDirect();
     num_arr.reserve(num_arr_names.varTop());
+    int_arr_names.deleteDirect();
+    int_arr.reserve(int_arr_names.varTop());
     str_arr_names.deleteDirect();
     str_arr.reserve(str_arr_names.varTop());
     str_lst_names.deleteDirect();
@@ -2486,10 +2780,14 @@ void Basic::inew(uint8_t mode) {
       // forget all variables
       nvar_names.deleteAll();
       nvar.reserve(0);
+      int_var_names.deleteAll();
+      int_var.reserve(0);
       svar_names.deleteAll();
       svar.reserve(0);
       num_arr_names.deleteAll();
       num_arr.reserve(0);
+      int_arr_names.deleteAll();
+      int_arr.reserve(0);
       str_arr_names.deleteAll();
       str_arr.reserve(0);
       str_lst_names.deleteAll();
@@ -2504,6 +2802,7 @@ void Basic::inew(uint8_t mode) {
     lstki = 0;  //FORスタックインデクスを0に初期化
     astk_num_i = 0;
     astk_str_i = 0;
+    astk_num_pend = astk_str_pend = 0;
 
     bool direct_mode = !(cip >= listbuf && cip < listbuf + size_list);
 
@@ -2511,6 +2810,7 @@ void Basic::inew(uint8_t mode) {
 
     if (listbuf)
       free(listbuf);
+    invalidate_program_index();
     // XXX: Should we be more generous here to avoid fragmentation?
     listbuf = (icode_t *)calloc(1, LISTBUF_INC * sizeof(icode_t));
     if (!listbuf) {
@@ -2620,6 +2920,7 @@ void SMALL Basic::irenum() {
     ld->line = newnum;
     index++;
   }
+  invalidate_program_index();
 }
 
 /***bc bas SAVE
@@ -2733,7 +3034,8 @@ void Basic::transcodeLineToUTF8(char *lbuf, encoding_t enc) {
 // 戻り値
 //   0:正常終了
 //   1:異常終了
-uint8_t SMALL Basic::loadPrgText(char *fname, uint8_t newmode, encoding_t enc) {
+uint8_t SMALL Basic::loadPrgText(char *fname, uint8_t newmode, encoding_t enc,
+                                 bool use_image) {
   int32_t len;
   uint8_t rc = 0;
   uint32_t last_line = 0;
@@ -2742,6 +3044,10 @@ uint8_t SMALL Basic::loadPrgText(char *fname, uint8_t newmode, encoding_t enc) {
   procs.reset();
   labels.reset();
 
+  use_image = use_image && CONFIG.token_cache && newmode != NEW_VAR;
+  if (use_image && load_prg_image(fname, newmode, enc))
+    return err ? 1 : 0;
+
   err = bfs.tmpOpen(fname, 0);
   if (err)
     return 1;
@@ -2803,6 +3109,8 @@ uint8_t SMALL Basic::loadPrgText(char *fname, uint8_t newmode, encoding_t enc) {
   }
   recalc_indent();
   bfs.tmpClose();
+  if (use_image && rc == 0)
+    save_prg_image(fname, enc);
   return rc;
 }
 
@@ -2869,10 +3177,12 @@ void SMALL Basic::idelete() {
             *p1++ = *p2++;          // 前へ詰める
         }
         *p1 = 0;  // リストの末尾に0を置く
+        invalidate_program_index();
       }
     }
   }
 
+  invalidate_program_index();
   initialize_proc_pointers();
   initialize_label_pointers();
   // continue on the next line, in the likely case the DELETE command didn't
@@ -2902,8 +3212,13 @@ void BASIC_FP Basic::init_stack_frame() {
     astk_num_i += p.locc_num;
     astk_str_i += p.locc_str;
   }
+  astk_num_i += astk_num_pend;
+  astk_str_i += astk_str_pend;
   gstk[gstki].num_args = 0;
   gstk[gstki].str_args = 0;
+  gstk[gstki].num_pend = astk_num_pend;
+  gstk[gstki].str_pend = astk_str_pend;
+  astk_num_pend = astk_str_pend = 0;
 }
 
 void BASIC_FP Basic::push_num_arg(num_t n) {
@@ -2964,35 +3279,62 @@ void BASIC_INT Basic::draw_profile(void) {
 }
 
 #ifdef SDL
-#define SDL_POLL_COUNTER_INIT 20
 #define SDL_INPUT_LATENCY_MS 4
+#define SDL_PROFILE_INTERVAL_MS 1
+
+static Uint32 input_timer_callback(Uint32 interval, void *param) {
+  request_attention();
+  return interval;
+}
 #endif
 
+volatile bool attention_needed = true;
+
 void BASIC_FP process_events(void) {
   static uint32_t last_frame;
 
+  if (!attention_needed)
+    return;
+#ifndef ATTENTION_ALWAYS
+  // Cleared before looking at anything so that events arriving while we
+  // are busy are not lost.
+  attention_needed = false;
+#endif
+
 #ifdef SDL
   // Polling input once after each frame introduces considerable input lag.
   // Event handling on SDL is relatively expensive, however, so we can only
   // afford a few extra polls, which we perform at SDL_INPUT_LATENCY_MS
-  // intervals.
-  // This function is called _very_ often, and even SDL_GetTicks64() does
-  // take some cycles to run, so we only check if it's time to poll every
-  // SDL_POLL_COUNTER_INIT calls.
+  // intervals. A timer raises the attention flag for that purpose.
+  static SDL_TimerID input_timer = 0;
+  if (!input_timer) {
+    SDL_InitSubSystem(SDL_INIT_TIMER);
+    input_timer = SDL_AddTimer(SDL_INPUT_LATENCY_MS, input_timer_callback,
+                               NULL);
+  }
+
+  // The sampling profiler needs to look at the interpreter more often than
+  // that.
+  static SDL_TimerID profile_timer = 0;
+  if (profile_enabled && !profile_timer) {
+    profile_timer = SDL_AddTimer(SDL_PROFILE_INTERVAL_MS,
+                                 input_timer_callback, NULL);
+  } else if (!profile_enabled && profile_timer) {
+    SDL_RemoveTimer(profile_timer);
+    profile_timer = 0;
+  }
 
-  Uint64 now;
   static Uint64 last_extra_poll = 0;
-  static int poll_counter = SDL_POLL_COUNTER_INIT;
-  if (--poll_counter <= 0) {
-    Uint64 now = SDL_GetTicks64();
-    if (now >= last_extra_poll + SDL_INPUT_LATENCY_MS) {
-      last_extra_poll = now;
-      platform_process_events();
-    }
-    poll_counter = SDL_POLL_COUNTER_INIT;
+  Uint64 now = SDL_GetTicks64();
+  if (now >= last_extra_poll + SDL_INPUT_LATENCY_MS) {
+    last_extra_poll = now;
+    platform_process_events();
   }
 #endif
 
+  if (bc && profile_enabled)
+    bc->profile_sample();
+
   if (vs23.frame() == last_frame) {
 #if defined(HAVE_TSF) && !defined(HOSTED) && !defined(SDL)
     // Wasn't able to get this to work without underruns in SDL-based builds.
@@ -3050,6 +3392,11 @@ void BASIC_FP process_events(void) {
     bc->event_handle_pad();
   event_profile[6] = micros();
 
+  for (int i = 1; i < EVENT_PROFILE_SAMPLES; ++i)
+    timing_record(EB_TIMING_CURSOR + i - 1,
+                  event_profile[i] - event_profile[i - 1]);
+  timing_frame_done(last_frame);
+
   if (bc && profile_enabled)
     bc->draw_profile();
 
@@ -3253,7 +3600,8 @@ num_t BASIC_INT Basic::nasc() {
 
   if (checkOpen())
     return 0;
-  BString a = istrexp();
+  BString tmp;
+  const BString &a = istrref(tmp);
   if (a.lengthMB() < 1) {
     E_ERR(VALUE, _("empty string"));
     return 0;
@@ -3826,7 +4174,7 @@ uint8_t SMALL Basic::ilrun() {
         return 0;
       ++encoding;
     }
-    loadPrgText((char *)fname.c_str(), newmode, (encoding_t)encoding);
+    loadPrgText((char *)fname.c_str(), newmode, (encoding_t)encoding, true);
   }
   if (err)
     return 0;
@@ -4045,9 +4393,8 @@ BString BASIC_INT Basic::istrvalue() {
 }
 
 BString BASIC_INT Basic::istrexp() {
-  BString value, tmp;
-
-  value = istrvalue();
+  BString value = istrvalue();
+  BString tmp;
 
   for (;;)
     switch (*cip) {
@@ -4067,6 +4414,44 @@ String concatenation operator.
     }
 }
 
+// Evaluates a string expression like istrexp(). If the expression is a
+// plain string variable, the variable itself is returned instead of a
+// copy, so that its multibyte index survives between calls. Otherwise the
+// result is stored in tmp.
+const BString &Basic::istrref(BString &tmp) {
+  icode_t *ip = cip;
+  BString *var = NULL;
+
+  if (*ip == I_SVAR) {
+    var = &svar.var(ip[1]);
+  } else if (*ip == I_LSVAR) {
+    var = &get_lsvar(ip[1]);
+    if (err) {
+      // leave it to istrexp() to report the error
+      err = 0;
+      var = NULL;
+    }
+  }
+
+  // A procedure called while evaluating the remaining arguments could
+  // modify the variable.
+  if (var && ip[2] != I_PLUS) {
+    bool has_fn = false;
+    for (int next; !has_fn && (next = token_size(ip)) > 0; ip += next) {
+      if (*ip == I_COLON || *ip == I_ELSE || *ip == I_IMPLICITENDIF)
+        break;
+      has_fn = *ip == I_FN;
+    }
+    if (!has_fn) {
+      cip += 2;
+      return *var;
+    }
+  }
+
+  tmp = istrexp();
+  return tmp;
+}
+
 /***bf bas LEN
 Returns the number of characters in a string or the number of elements in
 a list.
@@ -4090,7 +4475,8 @@ num_t BASIC_INT Basic::nlen() {
     ++cip;
     value = num_lst.var(*cip++).size();
   } else {
-    value = istrexp().lengthMB();
+    BString tmp;
+    value = istrref(tmp).lengthMB();
   }
   checkClose();
   return value;
@@ -4230,7 +4616,17 @@ num_t BASIC_FP Basic::ivalue() {
     case I_VARARR:
       i = *cip++;
       dims = get_array_dims(idxs);
-      value = num_arr.var(i).var(dims, idxs);
+      value = num_arr.var(i).get(dims, idxs);
+      break;
+
+    case I_IVAR:
+      value = int_var.var(*cip++);
+      break;
+
+    case I_IVARARR:
+      i = *cip++;
+      dims = get_array_dims(idxs);
+      value = int_arr.var(i).var(dims, idxs);
       break;
 
     case I_SVAR:
@@ -4311,10 +4707,16 @@ PROC f(x): RETURN @x * 2
 ***/
     case I_FN: {
       icode_t *lp;
-      icall();
       i = gstki;
+      icall();
       if (err)
         break;
+      if (gstki == i) {
+        // called compiled code
+        value = retval[0];
+        break;
+      }
+      i = gstki;
       for (;;) {
         lp = iexe(i);
         if (!lp || err)
@@ -4525,6 +4927,8 @@ void BASIC_FP Basic::do_gosub_p(icode_t *lp, icode_t *ip) {
   gstk[gstki].ip = cip;  // 中間コードポインタを退避
   gstk[gstki].num_args = 0;
   gstk[gstki].str_args = 0;
+  gstk[gstki].num_pend = 0;
+  gstk[gstki].str_pend = 0;
   gstk[gstki++].proc_idx = NO_PROC;
 
   clp = lp;  // 行ポインタを分岐先へ更新
@@ -4918,10 +5322,15 @@ void BASIC_FP Basic::icall() {
 
   int num_args = 0;
   int str_args = 0;
-  // Argument stack indices cannot be modified while arguments are evaluated
-  // because that would mess with the stack frame of the caller.
-  int new_astk_num_i = astk_num_i;
-  int new_astk_str_i = astk_str_i;
+  // Arguments are evaluated straight into the argument stack above the
+  // caller's frame. The stack indices cannot be modified while arguments
+  // are evaluated because that would mess with the stack frame of the
+  // caller, so the arguments are accounted for as pending; calls made while
+  // evaluating them will put their frames above.
+  index_t num_pend = astk_num_pend;
+  index_t str_pend = astk_str_pend;
+  int new_astk_num_i = astk_num_i + num_pend;
+  int new_astk_str_i = astk_str_i + str_pend;
   if (gstki > 0 && gstk[gstki - 1].proc_idx != NO_PROC) {
     struct proc_t &p = procs.proc(gstk[gstki - 1].proc_idx);
     new_astk_num_i += p.locc_num;
@@ -4929,26 +5338,26 @@ void BASIC_FP Basic::icall() {
   }
   if (*cip == I_OPEN) {
     ++cip;
-    QList<BString> strargs;
-    QList<num_t> numargs;
 
     if (*cip != I_CLOSE)
       for (;;) {
         if (is_strexp()) {
-          BString b = istrexp();
-          if (err)
-            return;
           if (new_astk_str_i >= SIZE_ASTK)
             goto overflow;
-          strargs.push_back(b);
+          astk_str[new_astk_str_i] = istrexp();
+          if (err)
+            goto out;
+          ++new_astk_str_i;
+          ++astk_str_pend;
           ++str_args;
         } else {
-          n = iexp();
-          if (err)
-            return;
           if (new_astk_num_i >= SIZE_ASTK)
             goto overflow;
-          numargs.push_back(n);
+          n = iexp();
+          if (err)
+            goto out;
+          astk_num[new_astk_num_i++] = n;
+          ++astk_num_pend;
           ++num_args;
         }
         if (*cip != I_COMMA)
@@ -4956,15 +5365,10 @@ void BASIC_FP Basic::icall() {
         ++cip;
       }
 
+    astk_num_pend = num_pend;
+    astk_str_pend = str_pend;
     if (checkClose())
       return;
-
-    for (int i = 0; i < strargs.size(); ++i) {
-      astk_str[new_astk_str_i++] = strargs[i];
-    }
-    for (int i = 0; i < numargs.size(); ++i) {
-      astk_num[new_astk_num_i++] = numargs[i];
-    }
   }
   astk_num_i = new_astk_num_i;
   astk_str_i = new_astk_str_i;
@@ -4973,11 +5377,28 @@ void BASIC_FP Basic::icall() {
     return;
   }
 
+  if (CONFIG.jit_threshold && !trace_enabled) {
+    if (!proc_loc.native && !proc_loc.no_native &&
+        ++proc_loc.call_count >= CONFIG.jit_threshold)
+      jit_compile(proc_idx);
+    if (proc_loc.native) {
+      uint32_t start = profile_enabled ? ESP.getCycleCount() : 0;
+      if (jit_call(proc_loc, num_args, str_args)) {
+        if (profile_enabled)
+          proc_loc.profile_total += ESP.getCycleCount() - start;
+        return;
+      }
+    }
+  }
+
   gstk[gstki].lp = clp;
   gstk[gstki].ip = cip;
   gstk[gstki].num_args = num_args;
   gstk[gstki].str_args = str_args;
+  gstk[gstki].num_pend = num_pend;
+  gstk[gstki].str_pend = str_pend;
   gstk[gstki++].proc_idx = proc_idx;
+  astk_num_pend = astk_str_pend = 0;
 
   clp = proc_loc.lp;
   cip = proc_loc.ip;
@@ -4989,6 +5410,9 @@ void BASIC_FP Basic::icall() {
   return;
 overflow:
   err = ERR_ASTKOF;
+out:
+  astk_num_pend = num_pend;
+  astk_str_pend = str_pend;
   return;
 }
 
@@ -5020,23 +5444,28 @@ void BASIC_FP Basic::ireturn() {
   if (!end_of_statement()) {
     int rcnt = 0, rscnt = 0;
     num_t my_retval[MAX_RETVALS];
-    BString *my_retstr[MAX_RETVALS];  // don't want to always construct all strings
+    // don't want to always construct all strings
+    alignas(BString) char my_retstr[MAX_RETVALS][sizeof(BString)];
     do {
       if (is_strexp())
-        my_retstr[rscnt++] = new BString(istrexp());
+        new (my_retstr[rscnt++]) BString(istrexp());
       else
         my_retval[rcnt++] = iexp();
     } while (*cip++ == I_COMMA && rcnt < MAX_RETVALS && rscnt < MAX_RETVALS);
     for (int i = 0; i < rcnt; ++i)
       retval[i] = my_retval[i];
     for (int i = 0; i < rscnt; ++i) {
-      retstr[i] = *my_retstr[i];
-      delete my_retstr[i];
+      BString *rs = (BString *)my_retstr[i];
+      retstr[i] = std::move(*rs);
+      rs->~BString();
     }
   }
 
-  astk_num_i -= gstk[--gstki].num_args;
-  astk_str_i -= gstk[gstki].str_args;
+  --gstki;
+  astk_num_i -= gstk[gstki].num_args + gstk[gstki].num_pend;
+  astk_str_i -= gstk[gstki].str_args + gstk[gstki].str_pend;
+  astk_num_pend = gstk[gstki].num_pend;
+  astk_str_pend = gstk[gstki].str_pend;
   if (gstki > 0 && gstk[gstki - 1].proc_idx != NO_PROC) {
     // XXX: This can change if the parent procedure was called by this one
     // (directly or indirectly)!
@@ -5094,6 +5523,8 @@ void BASIC_FP Basic::ido() {
   lstk[lstki].vto = -1;
   lstk[lstki].vstep = -1;
   lstk[lstki].index = -1;
+  lstk[lstki].integer = false;
+  lstk[lstki].next_ip = NULL;
   lstk[lstki++].local = false;
 }
 
@@ -5129,6 +5560,8 @@ void BASIC_FP Basic::iwhile() {
     lstk[lstki].vto = -1;
     lstk[lstki].vstep = -1;
     lstk[lstki].index = -2;
+    lstk[lstki].integer = false;
+    lstk[lstki].next_ip = NULL;
     lstk[lstki++].local = false;
   } else {
     icode_t *newip = getWENDptr(cip);
@@ -5206,6 +5639,11 @@ If no loop variable is specified in the `NEXT` command, the top-most `FOR`
 loop on the loop stack (that is, the one started last) will be iterated. If
 it is specified, the `FOR` loop associated with the given variable will be
 iterated, and any nested loops below it will be discarded.
+
+An integer loop variable is truncated after each increment. The loop ends
+when that leaves the variable unchanged (as with a fractional `increment`
+smaller than 1) or when the next value would not fit into an integer
+variable.
 \example
 ====
 ----
@@ -5231,10 +5669,17 @@ void BASIC_FP Basic::ifor() {
     index = *++cip;     // 変数名を取得
     ivar();             // 代入文を実行
     lstk[lstki].local = false;
+    lstk[lstki].integer = false;
   } else if (*cip == I_LVAR) {
     index = *++cip;
     ilvar();
     lstk[lstki].local = true;
+    lstk[lstki].integer = false;
+  } else if (*cip == I_IVAR) {
+    index = *++cip;
+    iivar();
+    lstk[lstki].local = false;
+    lstk[lstki].integer = true;
   } else {
     err = ERR_FORWOV;  // エラー番号をセット
   }
@@ -5269,7 +5714,25 @@ void BASIC_FP Basic::ifor() {
   // Special thanks hardyboy
   lstk[lstki].vto = vto;
   lstk[lstki].vstep = vstep;
-  lstk[lstki++].index = index;
+  lstk[lstki].index = index;
+  lstk[lstki].next_ip = NULL;
+
+  // If all values are integers, the number of iterations is known in
+  // advance, and NEXT only has to count them down.
+  num_t start = lstk[lstki].integer ? int_var.var(index) :
+                lstk[lstki].local   ? get_lvar(index) : nvar.var(index);
+  lstk[lstki].cur = start;
+  lstk[lstki].counted =
+    vstep != 0 && start == floor(start) && vto == floor(vto) &&
+    vstep == floor(vstep) && fabs(start) <= INT32_MAX &&
+    fabs(vto) <= INT32_MAX && fabs(vstep) <= INT32_MAX &&
+    fabs(vto + vstep) <= INT32_MAX;
+  if (lstk[lstki].counted) {
+    int64_t trips = ((int64_t)vto - (int64_t)start) / (int64_t)vstep;
+    lstk[lstki].remaining = trips > 0 ? trips : 0;
+  }
+
+  lstki++;
 }
 
 /***bc bas LOOP
@@ -5327,8 +5790,10 @@ Increments and tests the counter in a `FOR` loop.
 void BASIC_FP Basic::inext() {
   int want_index;  // variable we want to NEXT, if specified
   bool want_local;
+  bool want_integer;
   int index;       // loop variable index we will actually use
   bool local;
+  bool integer;
   num_t vto;       // end of loop value
   num_t vstep;     // increment value
 
@@ -5337,41 +5802,85 @@ void BASIC_FP Basic::inext() {
     return;
   }
 
-  if (*cip != I_VAR && *cip != I_LVAR)
-    want_index = -1;  // just use whatever is TOS
-  else {
-    want_local = *cip++ == I_LVAR;
-    want_index = *cip++;  // NEXT a specific loop variable
-  }
+  icode_t *next_ip = cip;
 
-  while (lstki) {
-    // Get index of loop variable on top of stack.
+  if (lstk[lstki - 1].next_ip == next_ip) {
+    // This NEXT has iterated the top-most loop before, no need to look
+    // at the variable.
+    cip += lstk[lstki - 1].next_len;
+    if (lstk[lstki - 1].counted && next_counted())
+      return;
     index = lstk[lstki - 1].index;
     local = lstk[lstki - 1].local;
+    integer = lstk[lstki - 1].integer;
+  } else {
+    if (*cip != I_VAR && *cip != I_LVAR && *cip != I_IVAR)
+      want_index = -1;  // just use whatever is TOS
+    else {
+      want_local = *cip == I_LVAR;
+      want_integer = *cip++ == I_IVAR;
+      want_index = *cip++;  // NEXT a specific loop variable
+    }
 
-    // Done if it's the one we want (or if none is specified).
-    if (want_index < 0 || (want_index == index && want_local == local))
-      break;
+    while (lstki) {
+      // Get index of loop variable on top of stack.
+      index = lstk[lstki - 1].index;
+      local = lstk[lstki - 1].local;
+      integer = lstk[lstki - 1].integer;
 
-    // If it is not the specified variable, we assume we
-    // want to NEXT to a loop higher up the stack.
-    lstki--;
-  }
+      // Done if it's the one we want (or if none is specified).
+      if (want_index < 0 ||
+          (want_index == index && want_local == local &&
+           want_integer == integer))
+        break;
 
-  if (!lstki) {
-    // Didn't find anything that matches the NEXT.
-    err = ERR_LSTKUF;  // XXX: have something more descriptive
-    return;
-  }
+      // If it is not the specified variable, we assume we
+      // want to NEXT to a loop higher up the stack.
+      lstki--;
+    }
 
-  num_t &loop_var = local ? get_lvar(index) : nvar.var(index);
+    if (!lstki) {
+      // Didn't find anything that matches the NEXT.
+      err = ERR_LSTKUF;  // XXX: have something more descriptive
+      return;
+    }
+
+    if (index < 0) {
+      // not a FOR loop
+      err = ERR_LSTKUF;
+      return;
+    }
+
+    lstk[lstki - 1].next_ip = next_ip;
+    lstk[lstki - 1].next_len = cip - next_ip;
+    if (lstk[lstki - 1].counted && next_counted())
+      return;
+  }
 
   vstep = lstk[lstki - 1].vstep;
-  loop_var += vstep;
   vto = lstk[lstki - 1].vto;
 
+  num_t new_value;
+  if (integer) {
+    int32_t &loop_var = int_var.var(index);
+    new_value = loop_var + vstep;
+    // The loop cannot go on if the counter overflows or makes no progress.
+    if (new_value > INT32_MAX || new_value < INT32_MIN ||
+        basic_int(new_value) == loop_var) {
+      lstki--;
+      return;
+    }
+    loop_var = basic_int(new_value);
+    new_value = loop_var;
+  } else {
+    num_t &loop_var = local ? get_lvar(index) : nvar.var(index);
+    loop_var += vstep;
+    new_value = loop_var;
+  }
+
   // Is this loop finished?
-  if (((vstep < 0) && (loop_var < vto)) || ((vstep > 0) && (loop_var > vto))) {
+  if (((vstep < 0) && (new_value < vto)) ||
+      ((vstep > 0) && (new_value > vto))) {
     lstki--;  // drop it from FOR stack
     return;
   }
@@ -5382,6 +5891,42 @@ void BASIC_FP Basic::inext() {
   TRACE;
 }
 
+// Iterates a FOR loop with a precomputed number of iterations. Returns
+// false if the program has modified the loop variable, in which case the
+// loop has to be handled normally from now on.
+bool BASIC_FP Basic::next_counted() {
+  auto &l = lstk[lstki - 1];
+
+  if (l.integer) {
+    int32_t &loop_var = int_var.var(l.index);
+    if (loop_var != l.cur) {
+      l.counted = false;
+      return false;
+    }
+    l.cur += l.vstep;
+    loop_var = l.cur;
+  } else {
+    num_t &loop_var = l.local ? get_lvar(l.index) : nvar.var(l.index);
+    if (loop_var != l.cur) {
+      l.counted = false;
+      return false;
+    }
+    l.cur += l.vstep;
+    loop_var = l.cur;
+  }
+
+  if (!l.remaining) {
+    lstki--;  // drop it from FOR stack
+    return true;
+  }
+  l.remaining--;
+
+  cip = l.ip;
+  clp = l.lp;
+  TRACE;
+  return true;
+}
+
 /***bc bas EXIT
 Exits a DO, FOR or WHILE loop.
 \usage
@@ -5407,8 +5952,10 @@ not iterated using more than one `LOOP`, `NEXT` or `WEND` statement.
 void BASIC_FP Basic::iexit() {
   int want_index;  // variable we want to EXIT (for EXIT FOR)
   bool want_local = false;
+  bool want_integer = false;
   int index;       // loop variable index we will actually use (for EXIT FOR)
   bool local;
+  bool integer;
 
   if (!lstki) {  // loop stack is empty
     E_ERR(NOEXIT, _("no active loops"));
@@ -5429,10 +5976,11 @@ void BASIC_FP Basic::iexit() {
   } else if (exit_what == I_WHILE) {
     search_for = I_WEND;
     want_index = -2;
-  } else if (*cip != I_VAR && *cip != I_LVAR)
+  } else if (*cip != I_VAR && *cip != I_LVAR && *cip != I_IVAR)
     want_index = -42;  // just use whatever is TOS
   else {
-    want_local = *cip++ == I_LVAR;
+    want_local = *cip == I_LVAR;
+    want_integer = *cip++ == I_IVAR;
     want_index = *cip++;  // NEXT a specific loop variable
   }
 
@@ -5440,10 +5988,12 @@ void BASIC_FP Basic::iexit() {
     // Get index of loop variable on top of stack.
     index = lstk[lstki - 1].index;
     local = lstk[lstki - 1].local;
+    integer = lstk[lstki - 1].integer;
 
     // Done if it's the one we want (or if none is specified).
     if ((want_index == -42 && index >= 0) ||		// found unspecific FOR loop
-        (want_index == index && want_local == local))	// found something else that matches
+        (want_index == index && want_local == local &&
+         want_integer == integer))			// found something else that matches
       break;
 
     // If nothing that matches can be found we assume we want to EXIT to a
@@ -5459,16 +6009,34 @@ void BASIC_FP Basic::iexit() {
 
   lstki--;  // drop the loop from the loop stack
 
+  // Use the cached end of the loop if this EXIT has been taken before.
+  bool cacheable = in_listbuf(cip);
+  uint64_t key = 0;
+  if (cacheable) {
+    key = jump_key(cip, JUMP_EXIT,
+                   (local << 24) | (integer << 25) | (index & 0xffffff));
+    icode_t *ip = find_jump(key);
+    if (ip) {
+      cip = ip;
+      TRACE;
+      return;
+    }
+  }
+
   // Jump past the end of the loop.
   icode_t *lp = cip;
   for (; clp;) {
     if (*lp == search_for) {
       icode_t *tlp = lp + 1;
       if ((want_index == -1 || want_index == -2) ||	// LOOP or WEND
-          (want_index == -42 && *tlp != I_LVAR && *tlp != I_VAR) ||	// unspecific NEXT
+          (want_index == -42 && *tlp != I_LVAR && *tlp != I_VAR &&
+           *tlp != I_IVAR) ||					// unspecific NEXT
           (local && *tlp++ == I_LVAR && *tlp++ == index) ||	// specific NEXT (local counter)
-          (!local && *tlp++ == I_VAR && *tlp++ == index)) {	// specific NEXT (global counter)
+          (integer && *tlp++ == I_IVAR && *tlp++ == index) ||	// specific NEXT (integer counter)
+          (!local && !integer && *tlp++ == I_VAR && *tlp++ == index)) {	// specific NEXT (global counter)
         cip = tlp;
+        if (cacheable)
+          add_jump(key, cip);
         TRACE;
         return;
       }
@@ -5700,12 +6268,36 @@ overloads that lead to graphics and/or sound glitches.
 `PROFILE ON` enables the profiler, `PROFILE OFF` disables it.
 
 `PROFILE ON` also enables the procedure profiler that helps determine the
-number of CPU cycles used in each BASIC procedure. After the program has
-been run, the results can be viewed using `PROFILE LIST`.
-\usage PROFILE <ON|OFF|LIST>
+number of CPU cycles used in each BASIC procedure, and the sampling
+profiler, which periodically records the program line that is being
+executed and the procedures that have been called to get there.
+
+After the program has been run, the results can be viewed using
+`PROFILE LIST`. It shows the lines in which most samples have been taken,
+and for each procedure the number of samples taken in the procedure itself
+("Self"), the number of samples taken in the procedure and all procedures
+called by it ("Incl"), and the number of CPU cycles spent in it.
+
+`PROFILE SAVE` writes the samples to a file in the "folded stacks" format
+used by flame graph tools.
+
+`PROFILE LOG` writes the duration of each stage of frame processing to a
+file in CSV format, one line per frame, until `PROFILE LOG OFF` is
+executed. The stages are the same as those that can be queried using
+`TIMING()`. Frame timing data is collected whether the profiler is enabled
+or not.
+\usage
+PROFILE <ON|OFF|LIST>
+
+PROFILE SAVE file$
+
+PROFILE LOG <file$|OFF>
+\args
+@file$	name of the file to write the samples or timing data to
 \bugs
 It is not possible to switch the system and procedure profiling on and off
 independently.
+\ref TIMING()
 ***/
 void Basic::iprofile() {
   switch (*cip++) {
@@ -5716,15 +6308,26 @@ void Basic::iprofile() {
     profile_enabled = false;
     break;
   case I_LIST:
-    for (int i = 0; i < procs.size(); ++i) {
-      struct proc_t &p = procs.proc(i);
-      sprintf(lbuf, "%10u %s", (unsigned int)p.profile_total, proc_names.name(i));
-      c_puts(lbuf);
-      newline();
+    profile_list();
+    break;
+  case I_SAVE: {
+    BString fname = getParamFname();
+    if (!err)
+      profile_save(fname.c_str());
+    break;
+  }
+  case I_LOG:
+    if (*cip == I_OFF) {
+      ++cip;
+      timing_log(NULL);
+    } else {
+      BString fname = getParamFname();
+      if (!err && timing_log(fname.c_str()))
+        err = ERR_FILE_OPEN;
     }
     break;
   default:
-    SYNTAX_T(_("expected ON, OFF or LIST"));
+    SYNTAX_T(_("expected ON, OFF, LIST, SAVE or LOG"));
     break;
   }
 }
@@ -5732,7 +6335,8 @@ void Basic::iprofile() {
 int Basic::exec(const char *filename) {
     free(listbuf);
     listbuf = NULL;
-    if (loadPrgText((char *)filename, NEW_ALL) == 0) {
+    invalidate_program_index();
+    if (loadPrgText((char *)filename, NEW_ALL, ENC_UTF8, true) == 0) {
       clp = listbuf;
       cip = clp + icodes_per_line_desc();
       irun(clp);
@@ -5859,14 +6463,19 @@ void Basic::iextcmd(void) {
 // Return value: next program execution position (line start)
 icode_t *BASIC_FP Basic::iexe(index_t stk) {
   utf8_int32_t c;  // 入力キー
+  bool check_keys = true;
   err = 0;
 
   while (*cip != I_EOL) {
     //強制的な中断の判定
-    if ((c = sc0.peekKey())) {  // If there are unread characters
-      if (process_hotkeys(c)) {
-        err_expected = NULL;
-        break;
+    // New keys can only have arrived if events have been processed.
+    if (check_keys) {
+      check_keys = false;
+      if ((c = sc0.peekKey())) {  // If there are unread characters
+        if (process_hotkeys(c)) {
+          err_expected = NULL;
+          break;
+        }
       }
     }
 
@@ -5876,7 +6485,10 @@ icode_t *BASIC_FP Basic::iexe(index_t stk) {
     } else
       SYNTAX_T(_("expected command"));
 
-    process_events();
+    if (attention_needed) {
+      process_events();
+      check_keys = true;
+    }
 
     if (err || gstki < stk)
       return NULL;
@@ -6044,6 +6656,7 @@ program was interrupted.
       lstki = lstki_save;
       astk_num_i = astk_num_i_save;
       astk_str_i = astk_str_i_save;
+      astk_num_pend = astk_str_pend = 0;
       break;
     }
   } else {
@@ -6290,6 +6903,12 @@ void SMALL Basic::basic() {
 Basic::Basic() {
   init_tcc();
   listbuf = NULL;
+  line_index_valid = false;
+  expr_index_valid = false;
+  data_index_valid = false;
+  profile_samples = 0;
+  profile_next_sample = 0;
+  list_end = -1;
   event_error_enabled = false;
   basic_events_disabled = false;
 }
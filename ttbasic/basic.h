@@ -15,6 +15,7 @@ typedef EB_TOKEN_TYPE index_t;
 #define icodes_per_ptr() (sizeof(void *) / sizeof(icode_t))
 
 #include <string.h>
+#include <unordered_map>
 #include <sdfiles.h>
 #include "BString.h"
 
@@ -23,6 +24,7 @@ typedef EB_TOKEN_TYPE index_t;
 #include "variable.h"
 #include "proc.h"
 #include "sound.h"
+#include "attention.h"
 
 #include <dyncall.h>
 #include <setjmp.h>
@@ -31,6 +33,7 @@ typedef EB_TOKEN_TYPE index_t;
 
 #define SIZE_LINE 256  // コマンドライン入力バッファサイズ + NULL
 #define SIZE_IBUF 256  // 中間コード変換バッファサイズ
+#define LISTBUF_INC 128  // size by which the list buffer is incremented when full
 
 extern char lbuf[SIZE_LINE];
 extern char tbuf[SIZE_LINE];
@@ -99,6 +102,31 @@ void BASIC_FP ilvar();
 
 #define basic_bool(x) ((x) ? -1 : 0)
 
+struct unaligned_num_t {
+  num_t n;
+} __attribute__((packed));
+
+#define UNALIGNED_NUM_T(ip) (reinterpret_cast<struct unaligned_num_t *>(ip)->n)
+
+// BASIC line number descriptor.
+// NB: A lot of code relies on next being the first element.
+typedef struct {
+#ifdef LOWMEM
+  uint8_t  next;
+#else
+  uint32_t next;
+#endif
+  union {
+    num_t raw_line;
+    struct {
+      uint32_t line;
+      int8_t indent;
+    };
+  };
+} __attribute__((packed)) line_desc_t;
+
+#define icodes_per_line_desc() (sizeof(line_desc_t) / sizeof(icode_t))
+
 #define NEW_ALL  0
 #define NEW_PROG 1
 #define NEW_VAR  2
@@ -119,6 +147,8 @@ extern void E_VALUE(int32_t from, int32_t to);
 
 extern "C" void BASIC_FP process_events(void);
 
+struct mat_view_t;
+
 class Basic {
 public:
   Basic();
@@ -127,6 +157,7 @@ public:
   void basic();
 
   void draw_profile(void);
+  void profile_sample();
   void event_handle_sprite();
   void event_handle_pad();
   void event_handle_play(int ch);
@@ -147,6 +178,21 @@ private:
   int list_free();
   icode_t *getlp(uint32_t lineno);
   uint32_t getlineIndex(uint32_t lineno);
+  void build_line_index();
+  uint32_t find_line_index(uint32_t lineno);
+  inline void invalidate_program_index() {
+    line_index_valid = false;
+    expr_index_valid = false;
+    data_index_valid = false;
+    jump_cache.clear();
+    list_end = -1;
+  }
+  inline bool in_listbuf(icode_t *p) {
+    return p >= listbuf && p < listbuf + size_list;
+  }
+  uint64_t jump_key(icode_t *p, int kind, uint32_t extra);
+  icode_t *find_jump(uint64_t key);
+  void add_jump(uint64_t key, icode_t *ip);
   icode_t *getELSEptr(icode_t *p, bool endif_only = false, int adjust = 0);
   icode_t *getWENDptr(icode_t *p);
   uint32_t countLines(uint32_t st = 0, uint32_t ed = UINT32_MAX);
@@ -161,9 +207,13 @@ private:
   int get_array_dims(int *idxs);
   num_t getparam();
 
+  bool get_mat_operand(mat_view_t &v);
+  num_t mat_reduce(int op);
+
   void initialize_proc_pointers(void);
   void initialize_label_pointers(void);
 
+  void build_data_index();
   bool find_next_data();
   void data_push();
   void data_pop();
@@ -211,7 +261,11 @@ private:
 
   void transcodeLineToUTF8(char *buf, encoding_t enc);
   uint8_t SMALL loadPrgText(char *fname, uint8_t newmode = NEW_ALL,
-                            encoding_t encoding = ENC_UTF8);
+                            encoding_t encoding = ENC_UTF8,
+                            bool use_image = false);
+  VarNames *image_names(int table);
+  void save_prg_image(const char *fname, encoding_t enc);
+  bool load_prg_image(const char *fname, uint8_t newmode, encoding_t enc);
 
   void init_stack_frame();
   void push_num_arg(num_t n);
@@ -248,6 +302,7 @@ private:
   friend int ::eb_add_command(const char *name, const enum token_t *syntax, eb_command_handler_t handler);
   friend int ::eb_add_numfun(const char *name, const enum token_t *syntax, eb_numfun_handler_t handler);
   friend int ::eb_add_strfun(const char *name, const enum token_t *syntax, eb_strfun_handler_t handler);
+  friend int ::eb_get_array(const char *name, eb_array_t *arr);
 
 #define DECL_FUNCS
 #include "numfuntbl.h"
@@ -258,6 +313,7 @@ private:
   bool is_strexp();
   BString istrvalue();
   BString istrexp();
+  const BString &istrref(BString &tmp);
   num_t irel_string();
 
   num_t nsvar_a(BString &);
@@ -269,6 +325,7 @@ private:
 
   num_t ivalue();
   num_t iexp();
+  num_t ior();
   num_t imul();
   num_t iplus();
   num_t irel();
@@ -348,14 +405,18 @@ private:
 
   int size_list;
 
-  NumVariables nvar;
+  NumVariables<num_t> nvar;
   VarNames nvar_names;
+  NumVariables<int32_t> int_var;
+  VarNames int_var_names;
   StringVariables svar;
   VarNames svar_names;
 
 #define MAX_ARRAY_DIMS 4
   NumArrayVariables<num_t> num_arr;
   VarNames num_arr_names;
+  NumArrayVariables<int32_t> int_arr;
+  VarNames int_arr_names;
   StringArrayVariables<BString> str_arr;
   VarNames str_arr_names;
   BasicListVariables<BString> str_lst;
@@ -370,6 +431,75 @@ private:
 
   icode_t *listbuf;  // Pointer to program list area
 
+  // Offset of the end of the program in listbuf (-1 if unknown), and the
+  // number of the last line. Used to append lines without searching.
+  int32_t list_end;
+  uint32_t list_last_line;
+
+  // Line number -> listbuf offset lookup table, sorted by line number.
+  // Rebuilt on demand after the program has been modified.
+  struct line_index_t {
+    uint32_t line;
+    uint32_t offset;
+  };
+  std::vector<line_index_t> line_index;
+  uint32_t line_index_end;  // offset of the end-of-program marker
+  bool line_index_valid;
+
+  // Cache of resolved block structure jumps (ELSE/ENDIF, WEND, EXIT),
+  // keyed by the position of the token the search started from.
+  // Filled as jumps are taken, cleared when the program is modified.
+  enum jump_kind_t {
+    JUMP_ELSE,
+    JUMP_ENDIF,
+    JUMP_WEND,
+    JUMP_EXIT,
+  };
+  struct jump_target_t {
+    uint32_t lp;  // offset of the target line
+    uint32_t ip;  // offset of the target token
+  };
+  std::unordered_map<uint64_t, jump_target_t> jump_cache;
+
+public:
+  // Compiled numeric expressions (see basic_expr.cpp)
+  struct expr_op_t {
+    uint32_t op;
+    uint32_t arg;  // variable index, or end of expression offset
+    union {
+      num_t num;      // constant
+      int64_t inum;   // integer constant
+    };
+  };
+
+private:
+  std::vector<expr_op_t> expr_code;
+  // listbuf offset -> index of compiled expression in expr_code
+  std::vector<int32_t> expr_index;
+  bool expr_index_valid;
+  int32_t compile_expr();
+  num_t run_expr(const expr_op_t *op);
+
+  // Sampling profiler (see basic_profile.cpp)
+  struct profile_node_t {
+    uint32_t parent;  // caller's node, or PROFILE_ROOT
+    uint32_t frame;   // procedure index or line number
+    uint32_t hits;    // samples taken at this line (leaves only)
+  };
+  std::vector<profile_node_t> profile_nodes;
+  // (parent << 32 | frame) -> index in profile_nodes
+  std::unordered_map<uint64_t, uint32_t> profile_node_index;
+  uint32_t profile_samples;
+  uint32_t profile_next_sample;
+  uint32_t profile_node(uint32_t parent, uint32_t frame);
+  void profile_reset();
+  void profile_list();
+  void profile_save(const char *fname);
+
+  void jit_compile(index_t proc_idx);
+  bool jit_call(proc_t &pr, int num_args, int str_args);
+  void jit_reset();
+
   icode_t *clp;  // Pointer current line
   icode_t *cip;  // Pointer current Intermediate code
   struct {
@@ -377,6 +507,8 @@ private:
     icode_t *ip;
     index_t num_args;
     index_t str_args;
+    index_t num_pend;  // caller's pending arguments below the frame
+    index_t str_pend;
     index_t proc_idx;
   } gstk[SIZE_GSTK];  // GOSUB stack
   index_t gstki;      // GOSUB stack index
@@ -386,6 +518,10 @@ private:
   index_t astk_num_i;
   BString astk_str[SIZE_ASTK];
   index_t astk_str_i;
+  // Arguments already evaluated into the stack by calls whose argument
+  // lists are still being parsed. Frames of nested calls go above them.
+  index_t astk_num_pend;
+  index_t astk_str_pend;
 
   struct {
     icode_t *lp;
@@ -394,9 +530,18 @@ private:
     num_t vstep;
     int16_t index;
     bool local;
+    bool integer;
+    // FOR loops only:
+    bool counted;        // integral bounds, iterations counted in remaining
+    uint32_t remaining;  // iterations left after the current one
+    num_t cur;           // value last assigned to the loop variable
+    icode_t *next_ip;    // NEXT known to iterate this loop
+    uint8_t next_len;    // size of the NEXT arguments
   } lstk[SIZE_LSTK];  // loop stack
   index_t lstki;      // loop stack index
 
+  bool next_counted();
+
   icode_t *cont_clp = NULL;
   icode_t *cont_cip = NULL;
 
@@ -416,7 +561,18 @@ private:
 
   icode_t *data_lp;
   icode_t *data_ip;
-  bool in_data;
+
+  // Location of every DATA element in the program: the DATA token for the
+  // first element of a statement, the separating comma for the others.
+  // Built on the first READ, rebuilt after the program has been modified.
+  struct data_item_t {
+    uint32_t line;
+    uint32_t lp;  // offset of the line
+    uint32_t ip;  // offset of the DATA or comma token
+  };
+  std::vector<data_item_t> data_index;
+  uint32_t data_pos;  // index of the item following the last one read
+  bool data_index_valid;
 
   void exec_sub(const char *filename);
 
@@ -174,13 +174,35 @@ removed in future releases.
   specified audio device will be used. To find out what audio devices are
   available you can use the `SYS$(1, index)` function.
 
+* `15`: Procedure compilation threshold [`0` (default) or larger] +
+  When set to a value other than `0`, procedures that have been called
+  this many times are compiled to native code, which then replaces the
+  interpreted procedure for the rest of the program run. Only procedures
+  limited to numeric assignments, `IF`, `FOR`, `WHILE`, `DO` and `RETURN`
+  statements with simple numeric expressions can be compiled; all others
+  continue to be interpreted. Compiled procedures do not run BASIC event
+  handlers and cannot be traced with `TRON`.
+
+* `16`: Tokenized program cache [`0` (default) or `1`] +
+  When enabled, `LOAD`, `RUN` and `CHAIN` save the tokenized form of a
+  program to a file next to the source file with the extension `.tok`,
+  and load that instead of parsing the source again until the source file
+  is modified. Programs using `#REQUIRE` or native functions are not
+  cached.
+
+* `17`: Compositor threads [`0` (default) to `8`] +
+  Number of threads that compose the screen from the text layer,
+  background layers and sprites, each of them working on a horizontal
+  band of the screen. `0` uses as many threads as there are processor
+  cores available to the compositor.
+
 \note
 To restore the default configuration, run the command `REMOVE
 "/sd/config.ini"` and restart the system.
 \ref BEEP FONT SAVE_CONFIG SCREEN
 ***/
 
-#define MAX_CONFIG_IDX 14
+#define MAX_CONFIG_IDX 17
 
 const char *config_option_strings[MAX_CONFIG_IDX + 1] = {
   "tv_norm",
@@ -198,6 +220,9 @@ const char *config_option_strings[MAX_CONFIG_IDX + 1] = {
   "record_at_boot",
   "editor",
   "audio_device",
+  "jit_threshold",
+  "token_cache",
+  "compose_threads",
 };
 
 void SMALL Basic::iconfig() {
@@ -335,6 +360,24 @@ void SMALL Basic::iconfig() {
     CONFIG.audio_device = istrexp();
     break;
 
+  case 15:
+    if (value < 0)
+      E_VALUE(0, UINT32_MAX);
+    else
+      CONFIG.jit_threshold = value;
+    break;
+
+  case 16:
+    CONFIG.token_cache = value != 0;
+    break;
+
+  case 17:
+    if (value < 0 || value > MAX_COMPOSE_THREADS)
+      E_VALUE(0, MAX_COMPOSE_THREADS);
+    else
+      CONFIG.compose_threads = value;
+    break;
+
   default:
     E_VALUE(0, MAX_CONFIG_IDX);
     break;
@@ -369,6 +412,9 @@ void loadConfig() {
 #endif
   CONFIG.editor = BString("joe");
   CONFIG.audio_device = BString("default");
+  CONFIG.jit_threshold = 0;
+  CONFIG.token_cache = false;
+  CONFIG.compose_threads = 0;
 
   // XXX: colorspace is not initialized yet, cannot use conversion methods
   if (sizeof(pixel_t) == 1)
@@ -421,6 +467,9 @@ void loadConfig() {
 #endif
       if (!strcasecmp(line, "editor")) CONFIG.editor = BString(v);
       if (!strcasecmp(line, "audio_device")) CONFIG.audio_device = BString(v);
+      if (!strcasecmp(line, "jit_threshold")) CONFIG.jit_threshold = strtoul(v, NULL, 0);
+      if (!strcasecmp(line, "token_cache")) CONFIG.token_cache = !!atoi(v);
+      if (!strcasecmp(line, "compose_threads")) CONFIG.compose_threads = atoi(v);
     }
   }
   fclose(f);
@@ -458,6 +507,9 @@ void isaveconfig() {
 #endif
   fprintf(f, "editor=%s\n", CONFIG.editor.c_str());
   fprintf(f, "audio_device=%s\n", CONFIG.audio_device.c_str());
+  fprintf(f, "jit_threshold=%u\n", (unsigned int)CONFIG.jit_threshold);
+  fprintf(f, "token_cache=%d\n", CONFIG.token_cache);
+  fprintf(f, "compose_threads=%d\n", CONFIG.compose_threads);
   for (int i = 0; i < CONFIG_COLS; ++i)
     fprintf(f, "color%d=%d,%d,%d\n", i,
       CONFIG.color_scheme[i][0],
@@ -0,0 +1,501 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2023 Ulrich Hecht
+
+// Numeric expression compiler
+//
+// Expressions in the program text are translated into a simple stack
+// machine code on their first evaluation and cached by their position in
+// listbuf. Only expressions made up of constants, simple numeric variables
+// and operators are compiled; anything else (functions, arrays, strings,
+// FN calls...) is left to the recursive descent parser in basic_math.cpp.
+// The code generated here must produce exactly the same results as the
+// parser, including operator precedence quirks.
+//
+// Integer variables and integral constants are kept as int64_t on the
+// stack, and operations on them are done with integer instructions as long
+// as the result is known to fit into the mantissa of a num_t, i.e. as long
+// as floating point arithmetic would have given the exact same result.
+// Everything else is converted to num_t first.
+
+#include "basic.h"
+
+enum {
+  EOP_NUM,
+  EOP_VAR,
+  EOP_LVAR,
+  EOP_NEG,
+  EOP_POW,
+  EOP_MUL,
+  EOP_DIV,
+  EOP_MOD,
+  EOP_LSHIFT,
+  EOP_RSHIFT,
+  EOP_ADD,
+  EOP_SUB,
+  EOP_CHKFIN,
+  EOP_EQ,
+  EOP_NEQ,
+  EOP_LT,
+  EOP_LTE,
+  EOP_GT,
+  EOP_GTE,
+  EOP_NOT,
+  EOP_AND,
+  EOP_OR,
+  EOP_XOR,
+  EOP_END,
+
+  EOP_INUM,
+  EOP_IVAR,
+  EOP_I2F,
+  EOP_INEG,
+  EOP_IMUL,
+  EOP_IMOD,
+  EOP_IADD,
+  EOP_ISUB,
+  EOP_IEQ,
+  EOP_INEQ,
+  EOP_ILT,
+  EOP_ILTE,
+  EOP_IGT,
+  EOP_IGTE,
+  EOP_INOT,
+  EOP_IAND,
+  EOP_IOR,
+  EOP_IXOR,
+};
+
+#define EXPR_STACK_SIZE 16
+
+#define EXPR_UNKNOWN  -1  // not compiled yet
+#define EXPR_NOCOMP   -2  // cannot be compiled
+
+// integers up to this many bits are exactly representable as num_t
+#define EXPR_EXACT_BITS 53
+
+union expr_val_t {
+  num_t n;
+  int64_t i;
+};
+
+class ExprCompiler {
+public:
+  ExprCompiler(icode_t *start, std::vector<Basic::expr_op_t> &code)
+    : ip(start), code(code) {
+  }
+
+  icode_t *ip;
+
+  // Same structure as Basic::ior() and friends.
+  bool cor() {
+    if (!cand())
+      return false;
+    for (;;) {
+      switch (*ip) {
+      case I_OR:
+        ++ip;
+        if (!cand())
+          return false;
+        binop(EOP_OR, EOP_IOR, max_bits());
+        break;
+      case I_XOR:
+        ++ip;
+        if (!cand())
+          return false;
+        binop(EOP_XOR, EOP_IXOR, max_bits());
+        break;
+      default: return true;
+      }
+    }
+  }
+
+  // The result of an expression is always a num_t.
+  void finish() {
+    to_float(0);
+  }
+
+private:
+  std::vector<Basic::expr_op_t> &code;
+
+  // Compile-time description of a stack slot.
+  struct slot_t {
+    bool is_int;
+    int bits;       // integer magnitude is less than 2^bits
+    int32_t konst;  // op pushing an integer constant, or -1
+  };
+  std::vector<slot_t> slots;
+
+  void emit(uint32_t op, uint32_t arg = 0, num_t num = 0) {
+    Basic::expr_op_t o = { op, arg, { num } };
+    code.push_back(o);
+  }
+  bool push(uint32_t op, uint32_t arg = 0, num_t num = 0) {
+    if (slots.size() >= EXPR_STACK_SIZE)
+      return false;
+    slot_t s = { false, 0, -1 };
+    slots.push_back(s);
+    emit(op, arg, num);
+    return true;
+  }
+  bool ipush(uint32_t op, uint32_t arg, int64_t inum, int bits,
+             bool konst = false) {
+    if (slots.size() >= EXPR_STACK_SIZE)
+      return false;
+    slot_t s = { true, bits, konst ? (int32_t)code.size() : -1 };
+    slots.push_back(s);
+    emit(op, arg);
+    code.back().inum = inum;
+    return true;
+  }
+  bool push_num(num_t n) {
+    // -0 must stay a num_t to keep its sign.
+    if (n >= INT32_MIN && n <= INT32_MAX && n == (int32_t)n &&
+        (n != 0 || !signbit(n))) {
+      int64_t i = (int32_t)n;
+      int bits = 0;
+      while (i >= ((int64_t)1 << bits) || i <= -((int64_t)1 << bits))
+        ++bits;
+      return ipush(EOP_INUM, 0, i, bits, true);
+    }
+    return push(EOP_NUM, 0, n);
+  }
+
+  slot_t &slot(int pos) {
+    return slots[slots.size() - 1 - pos];
+  }
+  int max_bits() {
+    return std::max(slot(0).bits, slot(1).bits);
+  }
+
+  // Convert the slot pos entries below the top of the stack to num_t.
+  void to_float(int pos) {
+    slot_t &s = slot(pos);
+    if (!s.is_int)
+      return;
+    if (s.konst >= 0) {
+      // Constants can simply be replaced.
+      Basic::expr_op_t &o = code[s.konst];
+      o.op = EOP_NUM;
+      o.num = (num_t)o.inum;
+    } else {
+      emit(EOP_I2F, pos);
+    }
+    s.is_int = false;
+    s.konst = -1;
+  }
+
+  // binary operator: two operands in, one out
+  void fbinop(uint32_t op) {
+    to_float(1);
+    to_float(0);
+    slots.pop_back();
+    emit(op);
+  }
+  // Use the integer instruction if both operands are integers and the
+  // result is exact.
+  void binop(uint32_t op, uint32_t iop, int bits) {
+    if (slot(0).is_int && slot(1).is_int && bits <= EXPR_EXACT_BITS) {
+      slots.pop_back();
+      slot(0).bits = bits;
+      slot(0).konst = -1;
+      emit(iop);
+    } else {
+      fbinop(op);
+    }
+  }
+
+  bool cand() {
+    if (*ip == I_BITREV) {
+      // NOT applies to a comparison and ends the AND chain.
+      ++ip;
+      if (!crel())
+        return false;
+      if (slot(0).is_int && slot(0).bits < EXPR_EXACT_BITS) {
+        slot(0).bits++;
+        slot(0).konst = -1;
+        emit(EOP_INOT);
+      } else {
+        to_float(0);
+        emit(EOP_NOT);
+      }
+      return true;
+    }
+    if (!crel())
+      return false;
+    while (*ip == I_AND) {
+      ++ip;
+      if (!cand())
+        return false;
+      binop(EOP_AND, EOP_IAND, max_bits());
+    }
+    return true;
+  }
+
+  bool crel() {
+    uint32_t op, iop;
+    if (!cplus())
+      return false;
+    for (;;) {
+      switch (*ip) {
+      case I_EQ:   op = EOP_EQ; iop = EOP_IEQ; break;
+      case I_NEQ:
+      case I_NEQ2: op = EOP_NEQ; iop = EOP_INEQ; break;
+      case I_LT:   op = EOP_LT; iop = EOP_ILT; break;
+      case I_LTE:  op = EOP_LTE; iop = EOP_ILTE; break;
+      case I_GT:   op = EOP_GT; iop = EOP_IGT; break;
+      case I_GTE:  op = EOP_GTE; iop = EOP_IGTE; break;
+      default: return true;
+      }
+      ++ip;
+      if (!cplus())
+        return false;
+      binop(op, iop, 1);
+    }
+  }
+
+  bool cplus() {
+    if (!cmul())
+      return false;
+    for (;;) {
+      switch (*ip) {
+      case I_PLUS:
+        ++ip;
+        if (!cmul())
+          return false;
+        binop(EOP_ADD, EOP_IADD, max_bits() + 1);
+        break;
+      case I_MINUS:
+        ++ip;
+        if (!cmul())
+          return false;
+        binop(EOP_SUB, EOP_ISUB, max_bits() + 1);
+        break;
+      default:
+        // Integer results are always finite.
+        if (!slot(0).is_int)
+          emit(EOP_CHKFIN);
+        return true;
+      }
+    }
+  }
+
+  bool cmul() {
+    uint32_t op;
+    // Unary operators apply to the whole term.
+    if (*ip == I_MINUS) {
+      ++ip;
+      if (!cmul())
+        return false;
+      if (slot(0).konst >= 0)
+        code[slot(0).konst].inum = -code[slot(0).konst].inum;
+      else if (slot(0).is_int)
+        emit(EOP_INEG);
+      else
+        emit(EOP_NEG);
+      return true;
+    } else if (*ip == I_PLUS) {
+      ++ip;
+      return cmul();
+    }
+
+    if (!cvalue())
+      return false;
+    for (;;) {
+      switch (*ip) {
+      case I_MUL:    op = EOP_MUL; break;
+      case I_DIV:    op = EOP_DIV; break;
+      case I_MOD:    op = EOP_MOD; break;
+      case I_LSHIFT: op = EOP_LSHIFT; break;
+      case I_RSHIFT: op = EOP_RSHIFT; break;
+      default: return true;
+      }
+      ++ip;
+      if (!cvalue())
+        return false;
+      if (op == EOP_MUL)
+        binop(op, EOP_IMUL, slot(0).bits + slot(1).bits);
+      else if (op == EOP_MOD)
+        binop(op, EOP_IMOD, slot(1).bits);
+      else
+        // Division yields fractions, and shifts convert negative numbers
+        // in a platform-dependent way; leave those to num_t.
+        fbinop(op);
+    }
+  }
+
+  bool cvalue() {
+    switch (*ip++) {
+    case I_NUM:
+      if (!push_num(UNALIGNED_NUM_T(ip)))
+        return false;
+      ip += icodes_per_num();
+      break;
+    case I_HEXNUM: {
+      uint32_t n;
+#if EB_TOKEN_TYPE == uint32_t
+      n = ip[0];
+      ++ip;
+#else
+      n = (uint32_t)ip[0] | ((uint32_t)ip[1] << 8) |
+          ((uint32_t)ip[2] << 16) | ((uint32_t)ip[3] << 24);
+      ip += 4;
+#endif
+      if (!ipush(EOP_INUM, 0, n, 32, true))
+        return false;
+      break;
+    }
+    case I_VAR:
+      if (!push(EOP_VAR, *ip++))
+        return false;
+      break;
+    case I_LVAR:
+      if (!push(EOP_LVAR, *ip++))
+        return false;
+      break;
+    case I_IVAR:
+      if (!ipush(EOP_IVAR, *ip++, 0, 32))
+        return false;
+      break;
+    case I_OPEN:
+      if (!cor() || *ip++ != I_CLOSE)
+        return false;
+      break;
+    default:
+      return false;
+    }
+
+    if (*ip == I_POW) {
+      ++ip;
+      if (!cvalue())
+        return false;
+      fbinop(EOP_POW);
+    }
+    return true;
+  }
+};
+
+// Compile the expression at cip. Returns the index of the code in
+// expr_code, or EXPR_NOCOMP if the expression cannot be compiled.
+int32_t Basic::compile_expr() {
+  uint32_t start = expr_code.size();
+  ExprCompiler c(cip, expr_code);
+
+  if (!c.cor()) {
+    expr_code.resize(start);
+    return EXPR_NOCOMP;
+  }
+  c.finish();
+
+  expr_op_t end = { EOP_END, (uint32_t)(c.ip - listbuf), { 0 } };
+  expr_code.push_back(end);
+  return start;
+}
+
+num_t BASIC_FP Basic::run_expr(const expr_op_t *op) {
+  expr_val_t stk[EXPR_STACK_SIZE];
+  expr_val_t *sp = stk;
+
+  for (;; ++op) {
+    switch (op->op) {
+    case EOP_NUM:    (sp++)->n = op->num; break;
+    case EOP_VAR:    (sp++)->n = nvar.var(op->arg); break;
+    case EOP_LVAR:
+      (sp++)->n = get_lvar(op->arg);
+      if (err)
+        goto error;
+      break;
+    case EOP_NEG:    sp[-1].n = 0 - sp[-1].n; break;
+    case EOP_POW:    --sp; sp[-1].n = pow(sp[-1].n, sp[0].n); break;
+    case EOP_MUL:    --sp; sp[-1].n *= sp[0].n; break;
+    case EOP_DIV:    --sp; sp[-1].n /= sp[0].n; break;
+    case EOP_MOD:
+      --sp;
+      sp[-1].n = (int64_t)sp[-1].n % (int64_t)sp[0].n;
+      break;
+    case EOP_LSHIFT:
+      --sp;
+      sp[-1].n = ((uint64_t)sp[-1].n) << (uint64_t)sp[0].n;
+      break;
+    case EOP_RSHIFT:
+      --sp;
+      sp[-1].n = ((uint64_t)sp[-1].n) >> (uint64_t)sp[0].n;
+      break;
+    case EOP_ADD:    --sp; sp[-1].n += sp[0].n; break;
+    case EOP_SUB:    --sp; sp[-1].n -= sp[0].n; break;
+    case EOP_CHKFIN:
+      if (!math_exceptions_disabled && !isfinite(sp[-1].n)) {
+        if (isinf(sp[-1].n))
+          err = ERR_DIVBY0;
+        else
+          err = ERR_FP;
+        goto error;
+      }
+      break;
+    case EOP_EQ:     --sp; sp[-1].n = basic_bool(sp[-1].n == sp[0].n); break;
+    case EOP_NEQ:    --sp; sp[-1].n = basic_bool(sp[-1].n != sp[0].n); break;
+    case EOP_LT:     --sp; sp[-1].n = basic_bool(sp[-1].n < sp[0].n); break;
+    case EOP_LTE:    --sp; sp[-1].n = basic_bool(sp[-1].n <= sp[0].n); break;
+    case EOP_GT:     --sp; sp[-1].n = basic_bool(sp[-1].n > sp[0].n); break;
+    case EOP_GTE:    --sp; sp[-1].n = basic_bool(sp[-1].n >= sp[0].n); break;
+    case EOP_NOT:    sp[-1].n = ~((int64_t)sp[-1].n); break;
+    case EOP_AND:
+      --sp;
+      sp[-1].n = ((int64_t)sp[-1].n) & ((int64_t)sp[0].n);
+      break;
+    case EOP_OR:
+      --sp;
+      sp[-1].n = ((int64_t)sp[-1].n) | ((int64_t)sp[0].n);
+      break;
+    case EOP_XOR:
+      --sp;
+      sp[-1].n = ((int64_t)sp[-1].n) ^ ((int64_t)sp[0].n);
+      break;
+    case EOP_END:
+      cip = listbuf + op->arg;
+      return sp[-1].n;
+
+    case EOP_INUM:   (sp++)->i = op->inum; break;
+    case EOP_IVAR:   (sp++)->i = int_var.var(op->arg); break;
+    case EOP_I2F:    sp[-1 - op->arg].n = sp[-1 - op->arg].i; break;
+    case EOP_INEG:   sp[-1].i = -sp[-1].i; break;
+    case EOP_IMUL:   --sp; sp[-1].i *= sp[0].i; break;
+    case EOP_IMOD:   --sp; sp[-1].i %= sp[0].i; break;
+    case EOP_IADD:   --sp; sp[-1].i += sp[0].i; break;
+    case EOP_ISUB:   --sp; sp[-1].i -= sp[0].i; break;
+    case EOP_IEQ:    --sp; sp[-1].i = basic_bool(sp[-1].i == sp[0].i); break;
+    case EOP_INEQ:   --sp; sp[-1].i = basic_bool(sp[-1].i != sp[0].i); break;
+    case EOP_ILT:    --sp; sp[-1].i = basic_bool(sp[-1].i < sp[0].i); break;
+    case EOP_ILTE:   --sp; sp[-1].i = basic_bool(sp[-1].i <= sp[0].i); break;
+    case EOP_IGT:    --sp; sp[-1].i = basic_bool(sp[-1].i > sp[0].i); break;
+    case EOP_IGTE:   --sp; sp[-1].i = basic_bool(sp[-1].i >= sp[0].i); break;
+    case EOP_INOT:   sp[-1].i = ~sp[-1].i; break;
+    case EOP_IAND:   --sp; sp[-1].i &= sp[0].i; break;
+    case EOP_IOR:    --sp; sp[-1].i |= sp[0].i; break;
+    case EOP_IXOR:   --sp; sp[-1].i ^= sp[0].i; break;
+    }
+  }
+
+error:
+  // Leave cip at the end of the expression.
+  while (op->op != EOP_END)
+    ++op;
+  cip = listbuf + op->arg;
+  return -1;
+}
+
+// Numeric expression evaluation
+num_t BASIC_FP Basic::iexp() {
+  if (in_listbuf(cip)) {
+    if (!expr_index_valid) {
+      expr_index.assign(size_list, EXPR_UNKNOWN);
+      expr_code.clear();
+      expr_index_valid = true;
+    }
+    int32_t &e = expr_index[cip - listbuf];
+    if (e == EXPR_UNKNOWN)
+      e = compile_expr();
+    if (e >= 0)
+      return run_expr(&expr_code[e]);
+  }
+  return ior();
+}
@@ -9,6 +9,7 @@
 
 #define SJSON_IMPLEMENT
 #include "sjson.h"
+#include "QList.h"
 
 #define __(s) (s)
 struct {
@@ -0,0 +1,349 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2023 Ulrich Hecht
+
+// Tokenized program cache
+//
+// After a program has been loaded from text, its intermediate code and name
+// tables are written to a file of the same name with the extension ".tok".
+// The next time the same program is loaded, the image is used instead of
+// tokenizing the source again, as long as the source file's size and
+// modification time and CRC-32, the firmware version, the keyword table, the
+// keyword separation setting and the text encoding all match. The CRC catches edits that keep the size of the file and are
+// saved within the resolution of the modification time.
+//
+// Variable, procedure and label indices in the image refer to the name
+// tables stored with it. They are translated to the current tables when the
+// image is loaded, so an image can also be used by CHAIN, which keeps the
+// variables of the calling program.
+//
+// Programs that depend on state established while tokenizing (modules
+// loaded by #REQUIRE, native function pointers) are never cached.
+
+#include <sys/stat.h>
+#include <miniz.h>
+
+#include "basic.h"
+#include "version.h"
+
+#define PRG_IMAGE_MAGIC  "EBT3"
+#define PRG_IMAGE_SUFFIX ".tok"
+#define PRG_IMAGE_TABLES 10
+
+uint32_t getlineno(icode_t *lp);
+
+struct prg_image_header_t {
+  char magic[4];
+  char version[32];
+  uint8_t icode_size;
+  uint8_t num_size;
+  uint8_t encoding;
+  uint8_t uses_line_numbers;
+  uint8_t keyword_sep_optional;
+  uint8_t pad[3];
+  uint32_t kw_count;  // number of built-in keywords
+  uint32_t kw_crc;    // CRC-32 of the built-in keywords, in token order
+  uint32_t src_size;
+  int64_t src_mtime;
+  uint32_t src_crc;
+  uint32_t list_size;   // icodes, including the terminating zero
+  uint32_t names_size;  // bytes of name table data
+};
+
+// "foo.bas" -> "foo.tok"
+static BString image_file_name(const char *fname) {
+  BString iname(fname);
+  int dot = iname.lastIndexOf('.');
+  if (dot > iname.lastIndexOf('/') &&
+      strcasecmp(iname.c_str() + dot, PRG_IMAGE_SUFFIX))
+    iname = iname.substring(0, dot);
+  return iname + BString(F(PRG_IMAGE_SUFFIX));
+}
+
+// Name table a token's operand index refers to, -1 if none.
+static int image_table(icode_t tok) {
+  switch (tok) {
+  case I_VAR:
+  case I_LVAR:       return 0;
+  case I_SVAR:
+  case I_LSVAR:      return 1;
+  case I_VARARR:     return 2;
+  case I_STRARR:     return 3;
+  case I_STRLST:
+  case I_STRLSTREF:  return 4;
+  case I_NUMLST:
+  case I_NUMLSTREF:  return 5;
+  case I_IVAR:       return 6;
+  case I_IVARARR:    return 7;
+  case I_PROC:
+  case I_CALL:
+  case I_FN:         return 8;
+  case I_LABEL:      return 9;
+  default:           return -1;
+  }
+}
+
+VarNames *Basic::image_names(int table) {
+  switch (table) {
+  case 0: return &nvar_names;
+  case 1: return &svar_names;
+  case 2: return &num_arr_names;
+  case 3: return &str_arr_names;
+  case 4: return &str_lst_names;
+  case 5: return &num_lst_names;
+  case 6: return &int_var_names;
+  case 7: return &int_arr_names;
+  case 8: return &proc_names;
+  default: return &label_names;
+  }
+}
+
+// Returns the location of the name index operand of the token at ip, or
+// NULL if it has none.
+static icode_t *image_operand(icode_t *ip, int &table) {
+  table = image_table(*ip);
+  if (table >= 0)
+    return ip + 1;
+  if (token_size(ip) == 3) {
+    // GOTO/GOSUB/RESTORE/, followed by a label
+    table = image_table(I_LABEL);
+    return ip + 2;
+  }
+  return NULL;
+}
+
+// Computes the CRC-32 of the contents of the file fname.
+static bool source_crc(const char *fname, uint32_t &crc) {
+  FILE *f = fopen(fname, "rb");
+  if (!f)
+    return false;
+
+  unsigned char buf[512];
+  size_t n;
+  crc = mz_crc32(MZ_CRC32_INIT, NULL, 0);
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    crc = mz_crc32(crc, buf, n);
+
+  bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
+
+// Token numbers depend on the keyword table, which may change between
+// builds with the same version string.
+static uint32_t keyword_crc() {
+  uint32_t crc = mz_crc32(MZ_CRC32_INIT, NULL, 0);
+  for (unsigned int i = 0; i < SIZE_KWTBL; ++i)
+    crc = mz_crc32(crc, (const unsigned char *)kwtbl_init[i],
+                   strlen(kwtbl_init[i]) + 1);
+  return crc;
+}
+
+static bool fill_image_header(prg_image_header_t &hdr, const char *fname,
+                              struct stat &st, int enc) {
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, PRG_IMAGE_MAGIC, sizeof(hdr.magic));
+  strncpy(hdr.version, STR_VARSION, sizeof(hdr.version));
+  hdr.icode_size = sizeof(icode_t);
+  hdr.num_size = sizeof(num_t);
+  hdr.encoding = enc;
+  hdr.keyword_sep_optional = CONFIG.keyword_sep_optional;
+  hdr.kw_count = SIZE_KWTBL;
+  hdr.kw_crc = keyword_crc();
+  hdr.src_size = st.st_size;
+  hdr.src_mtime = st.st_mtime;
+  return source_crc(fname, hdr.src_crc);
+}
+
+void Basic::save_prg_image(const char *fname, encoding_t enc) {
+  struct stat st;
+  if (stat(fname, &st))
+    return;
+
+  list_free();  // make sure list_end and list_last_line are valid
+
+  for (icode_t *lp = listbuf; *lp; lp += *lp) {
+    icode_t *ip = lp + icodes_per_line_desc();
+    for (int next; (next = token_size(ip)) > 0; ip += next) {
+      if (*ip >= SIZE_KWTBL || *ip == I_REQUIRE || *ip == I_NFC)
+        return;
+    }
+  }
+
+  prg_image_header_t hdr;
+  if (!fill_image_header(hdr, fname, st, enc))
+    return;
+  hdr.uses_line_numbers = uses_line_numbers;
+  hdr.list_size = list_end + 1;
+
+  for (int t = 0; t < PRG_IMAGE_TABLES; ++t) {
+    VarNames *names = image_names(t);
+    for (int i = 0; i < names->varTop(); ++i)
+      hdr.names_size += strlen(names->name(i)) + 1;
+    hdr.names_size += 1;
+  }
+
+  BString iname = image_file_name(fname);
+  FILE *f = fopen(iname.c_str(), "wb");
+  if (!f)
+    return;
+
+  bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+            fwrite(listbuf, sizeof(icode_t), hdr.list_size, f) == hdr.list_size;
+  for (int t = 0; ok && t < PRG_IMAGE_TABLES; ++t) {
+    VarNames *names = image_names(t);
+    for (int i = 0; ok && i < names->varTop(); ++i)
+      ok = fputs(names->name(i), f) >= 0 && fputc(0, f) != EOF;
+    ok = ok && fputc(0, f) != EOF;
+  }
+
+  if (fclose(f) || !ok)
+    remove(iname.c_str());
+}
+
+// Loads the cached image of the program source fname, if there is a valid
+// one. Returns false if the program has to be loaded from text.
+bool Basic::load_prg_image(const char *fname, uint8_t newmode, encoding_t enc) {
+  struct stat st;
+  if (stat(fname, &st))
+    return false;
+
+  BString iname = image_file_name(fname);
+  FILE *f = fopen(iname.c_str(), "rb");
+  if (!f)
+    return false;
+
+  prg_image_header_t hdr, want;
+  if (!fill_image_header(want, fname, st, enc) ||
+      fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      memcmp(hdr.magic, want.magic, sizeof(hdr.magic)) ||
+      memcmp(hdr.version, want.version, sizeof(hdr.version)) ||
+      hdr.icode_size != want.icode_size || hdr.num_size != want.num_size ||
+      hdr.encoding != want.encoding || hdr.src_size != want.src_size ||
+      hdr.keyword_sep_optional != want.keyword_sep_optional ||
+      hdr.kw_count != want.kw_count || hdr.kw_crc != want.kw_crc ||
+      hdr.src_mtime != want.src_mtime || hdr.src_crc != want.src_crc ||
+      hdr.list_size < 1 || hdr.list_size > 0x10000000 ||
+      hdr.names_size > 0x1000000) {
+    fclose(f);
+    return false;
+  }
+
+  size_t list_bytes = hdr.list_size * sizeof(icode_t);
+  char *img = (char *)malloc(list_bytes + hdr.names_size + 1);
+  if (!img) {
+    fclose(f);
+    return false;
+  }
+  bool ok = fread(img, 1, list_bytes + hdr.names_size, f) ==
+            list_bytes + hdr.names_size;
+  fclose(f);
+
+  icode_t *list = (icode_t *)img;
+  std::vector<const char *> names[PRG_IMAGE_TABLES];
+  std::vector<int> map[PRG_IMAGE_TABLES];
+  uint32_t last_line = 0;
+
+  // Split up the name tables.
+  char *np = img + list_bytes;
+  char *nend = np + hdr.names_size;
+  *nend = 0;
+  for (int t = 0; ok && t < PRG_IMAGE_TABLES; ++t) {
+    while (np < nend && *np) {
+      names[t].push_back(np);
+      np += strlen(np) + 1;
+    }
+    ok = np < nend;
+    ++np;
+    map[t].assign(names[t].size(), -1);
+  }
+
+  // Make sure the icode is well-formed before touching the program.
+  uint32_t pos = 0;
+  while (ok && list[pos]) {
+    uint32_t len = list[pos];
+    if (len <= icodes_per_line_desc() || pos + len >= hdr.list_size) {
+      ok = false;
+      break;
+    }
+    last_line = getlineno(list + pos);
+
+    icode_t *ip = list + pos + icodes_per_line_desc();
+    icode_t *end = list + pos + len;
+    for (int next; ok && ip < end && (next = token_size(ip)) > 0;
+         ip += next) {
+      int table;
+      icode_t *op = image_operand(ip, table);
+      ok = ip + next <= end &&
+           (!op || *op < names[table].size());
+    }
+    pos += len;
+  }
+  if (!ok || pos != hdr.list_size - 1) {
+    free(img);
+    return false;
+  }
+
+  inew(newmode);
+  if (err) {
+    free(img);
+    return true;
+  }
+
+  if (hdr.list_size > (uint32_t)size_list) {
+    int size = (hdr.list_size + LISTBUF_INC - 1) / LISTBUF_INC * LISTBUF_INC;
+    icode_t *buf = (icode_t *)realloc(listbuf, size * sizeof(icode_t));
+    if (!buf) {
+      free(img);
+      err = ERR_OOM;
+      return true;
+    }
+    listbuf = buf;
+    size_list = size;
+    clp = listbuf;
+  }
+  memcpy(listbuf, list, list_bytes);
+
+  // Translate name indices, assigning names in order of first use as the
+  // tokenizer would.
+  for (icode_t *lp = listbuf; *lp; lp += *lp) {
+    icode_t *ip = lp + icodes_per_line_desc();
+    for (int next; (next = token_size(ip)) > 0; ip += next) {
+      int table;
+      icode_t *op = image_operand(ip, table);
+      if (!op)
+        continue;
+      int &idx = map[table][*op];
+      if (idx < 0) {
+        idx = image_names(table)->assign(names[table][*op], true);
+        if (idx < 0) {
+          free(img);
+          inew(newmode);
+          err = ERR_OOM;
+          return true;
+        }
+      }
+      *op = idx;
+    }
+  }
+  free(img);
+
+  if (nvar.reserve(nvar_names.varTop()) ||
+      svar.reserve(svar_names.varTop()) ||
+      num_arr.reserve(num_arr_names.varTop()) ||
+      str_arr.reserve(str_arr_names.varTop()) ||
+      str_lst.reserve(str_lst_names.varTop()) ||
+      num_lst.reserve(num_lst_names.varTop()) ||
+      int_var.reserve(int_var_names.varTop()) ||
+      int_arr.reserve(int_arr_names.varTop()) ||
+      procs.reserve(proc_names.varTop()) ||
+      labels.reserve(label_names.varTop())) {
+    inew(newmode);
+    err = ERR_OOM;
+    return true;
+  }
+
+  uses_line_numbers = hdr.uses_line_numbers;
+  list_end = hdr.list_size - 1;
+  list_last_line = last_line;
+  return true;
+}
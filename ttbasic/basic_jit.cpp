@@ -0,0 +1,588 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2023 Ulrich Hecht
+
+// PROC compiler
+//
+// Procedures that are called often are translated to C and compiled in
+// memory using tcc. icall() then calls the compiled code directly instead
+// of interpreting the procedure.
+//
+// Only a subset of the language is supported: numeric assignments to
+// global variables, arguments and local variables, IF/ELSE/ENDIF,
+// FOR/NEXT, WHILE/WEND, DO/LOOP and RETURN with numeric values, and
+// numeric expressions made up of constants, simple variables and
+// operators. Procedures that use anything else are left to the
+// interpreter.
+
+#include <vector>
+
+#include "basic.h"
+#include "eb_native.h"
+#include "eb_sys.h"
+
+// Must match the definition in jit_prologue.
+struct jit_ctx {
+  num_t *v;  // global numeric variables
+  num_t *a;  // numeric arguments
+  num_t *l;  // numeric local variables
+  num_t *r;  // return values
+  int err;
+  int mathex_disabled;
+  double (*pow)(double, double);
+  int (*poll)(void);
+};
+
+static const char jit_prologue[] =
+  "typedef double num_t;\n"
+  "struct jit_ctx {\n"
+  "  num_t *v, *a, *l, *r;\n"
+  "  int err;\n"
+  "  int mathex_disabled;\n"
+  "  double (*pow)(double, double);\n"
+  "  int (*poll)(void);\n"
+  "};\n"
+  "static num_t chk(struct jit_ctx *c, num_t x) {\n"
+  "  if (!c->mathex_disabled && x - x != 0)\n"
+  "    c->err = x == x ? %d : %d;\n"
+  "  return x;\n"
+  "}\n"
+  "int jit_proc(struct jit_ctx *c) {\n";
+
+static std::vector<TCCState *> jit_states;
+
+class ProcTranslator {
+public:
+  ProcTranslator(Procedures &procs, index_t proc_idx)
+    : procs(procs), proc_idx(proc_idx), tmp(0) {
+  }
+
+  bool translate(BString &out);
+
+private:
+  Procedures &procs;
+  index_t proc_idx;
+  icode_t *ip;
+  int tmp;  // temporary variable counter
+  BString code;
+
+  struct block_t {
+    token_t kind;
+    int closes;      // number of braces to close at the end of the block
+    BString var;     // FOR loop variable
+    icode_t var_tok[2];
+    int n;           // FOR loop temporaries
+  };
+  std::vector<block_t> blocks;
+
+  bool cor(BString &s);
+  bool cand(BString &s);
+  bool crel(BString &s);
+  bool cplus(BString &s);
+  bool cmul(BString &s);
+  bool cvalue(BString &s);
+  bool lvalue(BString &s);
+  bool cond(BString &name);
+
+  void emit(const char *s) {
+    code += s;
+  }
+  void emit(const BString &s) {
+    code += s;
+  }
+  BString newtmp() {
+    return BString("t") + BString(tmp++);
+  }
+};
+
+static inline BString paren(const BString &s) {
+  return BString("(") + s + BString(")");
+}
+
+static inline BString to_ll(const BString &s) {
+  return BString("(long long)") + paren(s);
+}
+
+bool ProcTranslator::cor(BString &s) {
+  BString r;
+  if (!cand(s))
+    return false;
+  for (;;) {
+    const char *op;
+    switch (*ip) {
+    case I_OR:  op = "|"; break;
+    case I_XOR: op = "^"; break;
+    default: return true;
+    }
+    ++ip;
+    if (!cand(r))
+      return false;
+    s = BString("(num_t)(") + to_ll(s) + op + to_ll(r) + ")";
+  }
+}
+
+bool ProcTranslator::cand(BString &s) {
+  BString r;
+  if (*ip == I_BITREV) {
+    ++ip;
+    if (!crel(r))
+      return false;
+    s = BString("(num_t)~") + to_ll(r);
+    return true;
+  }
+  if (!crel(s))
+    return false;
+  while (*ip == I_AND) {
+    ++ip;
+    if (!cand(r))
+      return false;
+    s = BString("(num_t)(") + to_ll(s) + "&" + to_ll(r) + ")";
+  }
+  return true;
+}
+
+bool ProcTranslator::crel(BString &s) {
+  BString r;
+  if (!cplus(s))
+    return false;
+  for (;;) {
+    const char *op;
+    switch (*ip) {
+    case I_EQ:   op = "=="; break;
+    case I_NEQ:
+    case I_NEQ2: op = "!="; break;
+    case I_LT:   op = "<"; break;
+    case I_LTE:  op = "<="; break;
+    case I_GT:   op = ">"; break;
+    case I_GTE:  op = ">="; break;
+    default: return true;
+    }
+    ++ip;
+    if (!cplus(r))
+      return false;
+    s = BString("(num_t)(") + paren(s) + op + paren(r) + "?-1:0)";
+  }
+}
+
+bool ProcTranslator::cplus(BString &s) {
+  BString r;
+  if (!cmul(s))
+    return false;
+  for (;;) {
+    const char *op;
+    switch (*ip) {
+    case I_PLUS:  op = "+"; break;
+    case I_MINUS: op = "-"; break;
+    default:
+      s = BString("chk(c,") + s + ")";
+      return true;
+    }
+    ++ip;
+    if (!cmul(r))
+      return false;
+    s = paren(s) + op + paren(r);
+  }
+}
+
+bool ProcTranslator::cmul(BString &s) {
+  BString r;
+  if (*ip == I_MINUS) {
+    ++ip;
+    if (!cmul(r))
+      return false;
+    s = BString("(0-") + paren(r) + ")";
+    return true;
+  } else if (*ip == I_PLUS) {
+    ++ip;
+    return cmul(s);
+  }
+
+  if (!cvalue(s))
+    return false;
+  for (;;) {
+    token_t op = (token_t)*ip;
+    if (op != I_MUL && op != I_DIV && op != I_MOD &&
+        op != I_LSHIFT && op != I_RSHIFT)
+      return true;
+    ++ip;
+    if (!cvalue(r))
+      return false;
+    switch (op) {
+    case I_MUL: s = paren(s) + "*" + paren(r); break;
+    case I_DIV: s = paren(s) + "/" + paren(r); break;
+    case I_MOD: s = BString("(num_t)(") + to_ll(s) + "%" + to_ll(r) + ")"; break;
+    case I_LSHIFT:
+      s = BString("(num_t)((unsigned long long)") + paren(s) +
+          "<<(unsigned long long)" + paren(r) + ")";
+      break;
+    default:
+      s = BString("(num_t)((unsigned long long)") + paren(s) +
+          ">>(unsigned long long)" + paren(r) + ")";
+      break;
+    }
+  }
+}
+
+// Local variables and arguments are resolved at translation time.
+bool ProcTranslator::lvalue(BString &s) {
+  if (*ip == I_VAR) {
+    s = BString("c->v[") + BString((unsigned int)ip[1]) + "]";
+  } else if (*ip == I_LVAR) {
+    int off = procs.getNumArg(proc_idx, ip[1]);
+    if (off >= 0) {
+      s = BString("c->a[") + BString(off) + "]";
+    } else {
+      off = procs.getNumLoc(proc_idx, ip[1]);
+      if (off < 0)
+        return false;
+      s = BString("c->l[") + BString(off) + "]";
+    }
+  } else
+    return false;
+  ip += 2;
+  return true;
+}
+
+bool ProcTranslator::cvalue(BString &s) {
+  char buf[32];
+  BString r;
+
+  switch (*ip) {
+  case I_NUM:
+    sprintf(buf, "((num_t)%.17g)", UNALIGNED_NUM_T(ip + 1));
+    s = buf;
+    ip += icodes_per_num() + 1;
+    break;
+  case I_HEXNUM:
+#if EB_TOKEN_TYPE == uint32_t
+    sprintf(buf, "((num_t)%uU)", (unsigned int)ip[1]);
+    ip += 2;
+#else
+    sprintf(buf, "((num_t)%uU)", (uint32_t)ip[1] | ((uint32_t)ip[2] << 8) |
+                                 ((uint32_t)ip[3] << 16) | ((uint32_t)ip[4] << 24));
+    ip += 5;
+#endif
+    s = buf;
+    break;
+  case I_VAR:
+  case I_LVAR:
+    if (!lvalue(s))
+      return false;
+    break;
+  case I_OPEN:
+    ++ip;
+    if (!cor(s) || *ip++ != I_CLOSE)
+      return false;
+    s = paren(s);
+    break;
+  default:
+    return false;
+  }
+
+  if (*ip == I_POW) {
+    ++ip;
+    if (!cvalue(r))
+      return false;
+    s = BString("c->pow(") + s + "," + r + ")";
+  }
+  return true;
+}
+
+// Evaluate an expression into a new temporary, bailing out on errors.
+bool ProcTranslator::cond(BString &name) {
+  BString e;
+  if (!cor(e))
+    return false;
+  name = newtmp();
+  emit(BString("num_t ") + name + "=" + e + ";if(c->err)return -1;\n");
+  return true;
+}
+
+bool ProcTranslator::translate(BString &out) {
+  proc_t &pr = procs.proc(proc_idx);
+  icode_t *lp = pr.lp;
+  BString s, t;
+
+  ip = pr.ip;
+  for (;;) {
+    switch (*ip) {
+    case I_EOL:
+    case I_REM:
+    case I_SQUOT:
+      lp += *lp;
+      // We must not run into the next procedure or off the end of the
+      // program.
+      if (!*lp)
+        return false;
+      ip = lp + icodes_per_line_desc();
+      if (*ip == I_PROC)
+        return false;
+      break;
+
+    case I_COLON:
+      ++ip;
+      break;
+
+    case I_VAR:
+    case I_LVAR:
+      if (!lvalue(s) || *ip++ != I_EQ || !cor(t))
+        return false;
+      emit(s + "=" + t + ";if(c->err)return -1;\n");
+      break;
+
+    case I_IF: {
+      block_t b = { I_IF, 1 };
+      ++ip;
+      if (!cond(t) || *ip++ != I_THEN)
+        return false;
+      // "THEN <line number>" is a GOTO
+      if (*ip == I_NUM)
+        return false;
+      emit(BString("if(") + t + "){\n");
+      blocks.push_back(b);
+      break;
+    }
+
+    case I_ELSE:
+      if (blocks.empty() || blocks.back().kind != I_IF)
+        return false;
+      ++ip;
+      emit("}else{\n");
+      if (*ip == I_IF) {
+        // ELSE IF shares the ENDIF with the IF it belongs to.
+        ++ip;
+        if (!cond(t) || *ip++ != I_THEN || *ip == I_NUM)
+          return false;
+        emit(BString("if(") + t + "){\n");
+        blocks.back().closes++;
+      }
+      break;
+
+    case I_ENDIF:
+    case I_IMPLICITENDIF:
+      if (blocks.empty() || blocks.back().kind != I_IF)
+        return false;
+      ++ip;
+      for (int i = 0; i < blocks.back().closes; ++i)
+        emit("}");
+      emit("\n");
+      blocks.pop_back();
+      break;
+
+    case I_WHILE: {
+      block_t b = { I_WHILE, 1 };
+      ++ip;
+      emit("for(;;){\n");
+      if (!cond(t))
+        return false;
+      emit(BString("if(!") + t + ")break;\n");
+      blocks.push_back(b);
+      break;
+    }
+
+    case I_WEND:
+      if (blocks.empty() || blocks.back().kind != I_WHILE)
+        return false;
+      ++ip;
+      emit("if(c->poll())return -1;}\n");
+      blocks.pop_back();
+      break;
+
+    case I_DO: {
+      block_t b = { I_DO, 1 };
+      ++ip;
+      emit("for(;;){\n");
+      blocks.push_back(b);
+      break;
+    }
+
+    case I_LOOP:
+      if (blocks.empty() || blocks.back().kind != I_DO)
+        return false;
+      ++ip;
+      if (*ip == I_WHILE || *ip == I_UNTIL) {
+        bool until = *ip++ == I_UNTIL;
+        if (!cond(t))
+          return false;
+        emit(BString(until ? "if(" : "if(!") + t + ")break;\n");
+      }
+      emit("if(c->poll())return -1;}\n");
+      blocks.pop_back();
+      break;
+
+    case I_FOR: {
+      block_t b = { I_FOR, 2 };
+      BString to, step;
+      ++ip;
+      b.var_tok[0] = ip[0];
+      b.var_tok[1] = ip[1];
+      if (!lvalue(b.var) || *ip++ != I_EQ || !cond(t))
+        return false;
+      emit(b.var + "=" + t + ";\n");
+      if (*ip++ != I_TO || !cor(to))
+        return false;
+      b.n = tmp++;
+      emit(BString("{num_t to") + BString(b.n) + "=" + to + ";\n");
+      if (*ip == I_STEP) {
+        ++ip;
+        if (!cor(step))
+          return false;
+      } else
+        step = "1";
+      emit(BString("num_t st") + BString(b.n) + "=" + step +
+           ";if(c->err)return -1;\nfor(;;){\n");
+      blocks.push_back(b);
+      break;
+    }
+
+    case I_NEXT: {
+      if (blocks.empty() || blocks.back().kind != I_FOR)
+        return false;
+      block_t &b = blocks.back();
+      ++ip;
+      if (*ip == I_VAR || *ip == I_LVAR) {
+        if (ip[0] != b.var_tok[0] || ip[1] != b.var_tok[1])
+          return false;
+        ip += 2;
+      }
+      BString to = BString("to") + BString(b.n);
+      BString st = BString("st") + BString(b.n);
+      emit(b.var + "+=" + st + ";\n");
+      emit(BString("if((") + st + "<0&&" + b.var + "<" + to + ")||(" +
+           st + ">0&&" + b.var + ">" + to + "))break;\n");
+      emit("if(c->poll())return -1;}}\n");
+      blocks.pop_back();
+      break;
+    }
+
+    case I_RETURN: {
+      int n = 0;
+      BString vals[MAX_RETVALS];
+      ++ip;
+      if (*ip != I_EOL && *ip != I_COLON && *ip != I_ELSE &&
+          *ip != I_IMPLICITENDIF && *ip != I_SQUOT) {
+        for (;;) {
+          if (n >= MAX_RETVALS || !cond(vals[n++]))
+            return false;
+          if (*ip != I_COMMA)
+            break;
+          ++ip;
+        }
+      }
+      emit("{");
+      for (int i = 0; i < n; ++i)
+        emit(BString("c->r[") + BString(i) + "]=" + vals[i] + ";");
+      emit(BString("return ") + BString(n) + ";}\n");
+      // A RETURN outside of any block ends the procedure; anything
+      // following it cannot be reached from within the procedure.
+      if (blocks.empty()) {
+        char prologue[sizeof(jit_prologue) + 16];
+        sprintf(prologue, jit_prologue, ERR_DIVBY0, ERR_FP);
+        out = prologue;
+        out += code;
+        out += "}\n";
+        return true;
+      }
+      break;
+    }
+
+    default:
+      return false;
+    }
+  }
+}
+
+static void jit_error(void *opaque, const char *msg) {
+  // Compilation failures only mean we fall back to the interpreter.
+}
+
+// Attempt to compile a procedure to native code.
+void Basic::jit_compile(index_t proc_idx) {
+  proc_t &pr = procs.proc(proc_idx);
+  BString src;
+  ProcTranslator tr(procs, proc_idx);
+
+  pr.no_native = true;
+
+  if (!tr.translate(src))
+    return;
+
+  TCCState *tcc = eb_tcc_new(TCC_OUTPUT_MEMORY);
+  if (!tcc)
+    return;
+  eb_tcc_initialize_symbols(tcc);
+  tcc_set_error_func(tcc, NULL, jit_error);
+
+  if (tcc_compile_string(tcc, src.c_str()) < 0 ||
+      tcc_relocate(tcc, TCC_RELOCATE_AUTO) < 0) {
+    tcc_delete(tcc);
+    return;
+  }
+
+  pr.native = tcc_get_symbol(tcc, "jit_proc");
+  if (!pr.native) {
+    tcc_delete(tcc);
+    return;
+  }
+
+  jit_states.push_back(tcc);
+  pr.no_native = false;
+}
+
+// Loop iterations in native code check for events and hotkeys, but only
+// if there is anything to look at.
+static int jit_poll(void) {
+  if (!attention_needed)
+    return 0;
+  return eb_process_events_check();
+}
+
+// Call the compiled version of a procedure whose arguments have already
+// been pushed. Returns false if the interpreter has to be used instead.
+bool BASIC_FP Basic::jit_call(proc_t &pr, int num_args, int str_args) {
+  if (astk_num_i + pr.locc_num > SIZE_ASTK)
+    return false;
+
+  jit_ctx ctx = {
+    &nvar.var(0),
+    &astk_num[astk_num_i - num_args],
+    &astk_num[astk_num_i],
+    retval,
+    0,
+    math_exceptions_disabled,
+    pow,
+    jit_poll,
+  };
+
+  // BASIC event handlers cannot run while native code is executing.
+  bool events_disabled = basic_events_disabled;
+  basic_events_disabled = true;
+  int rc = ((int (*)(jit_ctx *))pr.native)(&ctx);
+  basic_events_disabled = events_disabled;
+
+  if (rc < 0 && !err)
+    err = ctx.err;
+
+  // Drop the stack frame, same as ireturn().
+  astk_num_i -= num_args + astk_num_pend;
+  astk_str_i -= str_args + astk_str_pend;
+  if (gstki > 0 && gstk[gstki - 1].proc_idx != NO_PROC) {
+    struct proc_t &p = procs.proc(gstk[gstki - 1].proc_idx);
+    astk_num_i -= p.locc_num;
+    astk_str_i -= p.locc_str;
+  }
+
+  return true;
+}
+
+// Discard all compiled procedures.
+void Basic::jit_reset() {
+  for (int i = 0; i < procs.size(); ++i) {
+    proc_t &pr = procs.proc(i);
+    pr.native = NULL;
+    pr.no_native = false;
+    pr.call_count = 0;
+  }
+  for (auto tcc : jit_states)
+    tcc_delete(tcc);
+  jit_states.clear();
+}
@@ -0,0 +1,500 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2023 Ulrich Hecht
+
+// Whole-array operations (MAT, MATSUM(), MATMIN(), MATMAX())
+//
+// The kernels use GCC vector extensions, which are compiled to NEON or SSE
+// instructions where available and to plain loops elsewhere. They are used
+// whenever all operands have the same element type; other combinations go
+// through num_t one element at a time.
+
+#include <type_traits>
+#include "basic.h"
+
+// A range of elements of a numeric or integer array.
+struct mat_view_t {
+  void *data;
+  int type;            // NA_*; integer arrays are NA_INT32
+  unsigned int esize;  // element size in bytes
+  unsigned int count;  // elements from the start of the range to the end
+                       // of the array
+};
+
+#define MAT_VEC_SIZE 16
+
+template <typename E> struct mat_vec {
+  typedef E type __attribute__((vector_size(MAT_VEC_SIZE)));
+};
+
+// Integer arithmetic is done unsigned so that overflows wrap around.
+template <typename E> struct mat_arith {
+  typedef E type;
+};
+template <> struct mat_arith<int8_t> {
+  typedef uint8_t type;
+};
+template <> struct mat_arith<int16_t> {
+  typedef uint16_t type;
+};
+template <> struct mat_arith<int32_t> {
+  typedef uint32_t type;
+};
+
+struct mat_op_add {
+  template <typename T> T operator()(T a, T b) const {
+    return a + b;
+  }
+};
+struct mat_op_mul {
+  template <typename T> T operator()(T a, T b) const {
+    return a * b;
+  }
+};
+
+template <typename E> static inline typename mat_vec<E>::type mat_splat(E v) {
+  typename mat_vec<E>::type r;
+  for (unsigned int i = 0; i < MAT_VEC_SIZE / sizeof(E); ++i)
+    r[i] = v;
+  return r;
+}
+
+template <typename E> static void mat_fill(E *d, E v, unsigned int n) {
+  typedef typename mat_vec<E>::type V;
+  const unsigned int lanes = sizeof(V) / sizeof(E);
+  V vv = mat_splat(v);
+  unsigned int i = 0;
+  for (; i + lanes <= n; i += lanes)
+    memcpy(d + i, &vv, sizeof(V));
+  for (; i < n; ++i)
+    d[i] = v;
+}
+
+// d[i] = op(a[i], b ? b[i] : s)
+template <typename E, typename Op>
+static void mat_map(E *d, const E *a, const E *b, E s, unsigned int n,
+                    Op op) {
+  typedef typename mat_arith<E>::type A;
+  typedef typename mat_vec<A>::type V;
+  const unsigned int lanes = sizeof(V) / sizeof(E);
+  V vs = mat_splat((A)s);
+  unsigned int i = 0;
+  for (; i + lanes <= n; i += lanes) {
+    V va, vb;
+    memcpy(&va, a + i, sizeof(V));
+    if (b)
+      memcpy(&vb, b + i, sizeof(V));
+    else
+      vb = vs;
+    va = op(va, vb);
+    memcpy(d + i, &va, sizeof(V));
+  }
+  for (; i < n; ++i)
+    d[i] = (E)op((A)a[i], b ? (A)b[i] : (A)s);
+}
+
+template <typename E> static num_t mat_sum(const E *s, unsigned int n) {
+  if (std::is_integral<E>::value) {
+    // Cannot overflow for any realistic array size.
+    int64_t sum = 0;
+    for (unsigned int i = 0; i < n; ++i)
+      sum += s[i];
+    return sum;
+  }
+
+  typedef typename mat_vec<E>::type V;
+  const unsigned int lanes = sizeof(V) / sizeof(E);
+  // Partial sums are flushed to a num_t regularly to limit the loss of
+  // precision when adding up large single-precision arrays.
+  const unsigned int chunk = lanes * 256;
+  num_t sum = 0;
+  unsigned int i = 0;
+  while (i + lanes <= n) {
+    V acc = mat_splat((E)0);
+    unsigned int end = i + chunk < n ? i + chunk : n;
+    for (; i + lanes <= end; i += lanes) {
+      V v;
+      memcpy(&v, s + i, sizeof(V));
+      acc += v;
+    }
+    for (unsigned int l = 0; l < lanes; ++l)
+      sum += acc[l];
+  }
+  for (; i < n; ++i)
+    sum += s[i];
+  return sum;
+}
+
+template <typename E>
+static num_t mat_minmax(const E *s, unsigned int n, bool want_max) {
+  typedef typename mat_vec<E>::type V;
+  const unsigned int lanes = sizeof(V) / sizeof(E);
+  E m = s[0];
+  unsigned int i = 0;
+  if (n >= lanes) {
+    V vm;
+    memcpy(&vm, s, sizeof(V));
+    for (i = lanes; i + lanes <= n; i += lanes) {
+      V v;
+      memcpy(&v, s + i, sizeof(V));
+      if (want_max)
+        vm = v > vm ? v : vm;
+      else
+        vm = v < vm ? v : vm;
+    }
+    m = vm[0];
+    for (unsigned int l = 1; l < lanes; ++l)
+      m = (want_max ? vm[l] > m : vm[l] < m) ? vm[l] : m;
+  }
+  for (; i < n; ++i)
+    m = (want_max ? s[i] > m : s[i] < m) ? s[i] : m;
+  return m;
+}
+
+static num_t mat_get(const mat_view_t &v, unsigned int i) {
+  switch (v.type) {
+  case NA_INT8:    return ((int8_t *)v.data)[i];
+  case NA_INT16:   return ((int16_t *)v.data)[i];
+  case NA_INT32:   return ((int32_t *)v.data)[i];
+  case NA_FLOAT32: return ((float *)v.data)[i];
+  default:         return ((num_t *)v.data)[i];
+  }
+}
+
+static void mat_set(const mat_view_t &v, unsigned int i, num_t value) {
+  switch (v.type) {
+  case NA_INT8:    ((int8_t *)v.data)[i] = basic_int(value); break;
+  case NA_INT16:   ((int16_t *)v.data)[i] = basic_int(value); break;
+  case NA_INT32:   ((int32_t *)v.data)[i] = basic_int(value); break;
+  case NA_FLOAT32: ((float *)v.data)[i] = value; break;
+  default:         ((num_t *)v.data)[i] = value; break;
+  }
+}
+
+// Converts a scalar to the element type. Returns false if the kernels
+// would not give the same result as storing each element through num_t.
+template <typename E> static bool mat_scalar(num_t s, E &out) {
+  if (std::is_integral<E>::value) {
+    if (!isfinite(s) || s != trunc(s))
+      return false;
+    // Integer arithmetic wraps around anyway, so truncating the scalar
+    // does not change the result.
+    out = (E)basic_int(s);
+    return true;
+  }
+  out = (E)s;
+  return (num_t)out == s;
+}
+
+// Fast path for operands of the same type. Returns false if not applicable.
+template <typename E>
+static bool mat_kernel(const mat_view_t &d, const mat_view_t *a,
+                       const mat_view_t *b, int op, num_t s,
+                       unsigned int n) {
+  E es = 0;
+  if ((!a || !b) && !mat_scalar(s, es))
+    return false;
+
+  E *dp = (E *)d.data;
+  const E *ap = a ? (const E *)a->data : NULL;
+  const E *bp = b ? (const E *)b->data : NULL;
+
+  if (!a)
+    mat_fill(dp, es, n);
+  else if (op == I_PLUS)
+    mat_map(dp, ap, bp, es, n, mat_op_add());
+  else
+    mat_map(dp, ap, bp, es, n, mat_op_mul());
+  return true;
+}
+
+// Parses an array operand: "a()" is the whole array, "a(n)" the elements
+// starting at linear offset n.
+bool Basic::get_mat_operand(mat_view_t &v) {
+  int tok = *cip;
+  if (tok != I_VARARR && tok != I_IVARARR) {
+    SYNTAX_T(_("expected array"));
+    return true;
+  }
+  index_t idx = cip[1];
+  cip += 2;
+
+  unsigned int total;
+  if (tok == I_VARARR) {
+    NumArray<num_t> &arr = num_arr.var(idx);
+    v.data = arr.data();
+    v.type = arr.type();
+    v.esize = arr.elementSize(v.type);
+    total = arr.dims() ? arr.total() : 0;
+  } else {
+    NumArray<int32_t> &arr = int_arr.var(idx);
+    v.data = arr.data();
+    v.type = NA_INT32;
+    v.esize = sizeof(int32_t);
+    total = arr.dims() ? arr.total() : 0;
+  }
+  if (!v.data) {
+    err = ERR_UNDEFARR;
+    return true;
+  }
+
+  int32_t off = 0;
+  if (*cip != I_CLOSE && getParam(off, 0, total, I_NONE))
+    return true;
+  if (checkClose())
+    return true;
+
+  v.data = (char *)v.data + off * v.esize;
+  v.count = total - off;
+  return false;
+}
+
+static inline bool is_mat_operand(icode_t *ip) {
+  return *ip == I_VARARR || *ip == I_IVARARR;
+}
+
+// Makes a private copy of src if it overlaps dst without being identical
+// to it, so that elements are not overwritten before they have been read.
+static bool mat_unalias(const mat_view_t &dst, mat_view_t &src,
+                        unsigned int n, void *&tmp) {
+  char *d = (char *)dst.data;
+  char *s = (char *)src.data;
+  if (s == d || s >= d + n * dst.esize || d >= s + n * src.esize)
+    return false;
+  tmp = malloc(n * src.esize);
+  if (!tmp) {
+    err = ERR_OOM;
+    return true;
+  }
+  memcpy(tmp, s, n * src.esize);
+  src.data = tmp;
+  return false;
+}
+
+/***bc bas MAT
+Performs an operation on all elements of an array.
+\usage
+MAT dest() = value [, count]
+
+MAT dest() = src() [, count]
+
+MAT dest() = src() <+|*> value [, count]
+
+MAT dest() = src1() <+|*> src2() [, count]
+\args
+@dest	numeric or integer array to store the results in
+@value	numeric expression
+@src	numeric or integer array
+@src1	numeric or integer array
+@src2	numeric or integer array
+@count	number of elements to process
+	[default: all elements up to the end of the shortest array]
+\desc
+`MAT` assigns a value to a range of array elements, copies elements from
+another array, or adds or multiplies them by a value or by the elements
+of a second array.
+
+An array written with empty parentheses stands for all of its elements. An
+array followed by an index in parentheses stands for the elements starting
+at that index, so that `MAT a(10) = b(), 5` copies the first five elements
+of `b()` to `a(10)` through `a(14)`. Arrays with more than one dimension are
+treated as a single sequence of elements in which the first index changes
+fastest.
+
+The arrays may be of different types. Values are converted as in an
+assignment to each element. Operations on arrays of the same type are
+much faster, though.
+\note
+`MAT`, `MATSUM`, `MATMIN` and `MATMAX` are keywords. Programs written for
+earlier versions that use variables of these names (such as `mat` or
+`mat$`) have to rename them.
+\example
+====
+----
+DIM a(99) AS FLOAT, b(99) AS FLOAT
+MAT a() = 1
+MAT b() = a() * 3
+MAT a() = a() + b()
+PRINT MATSUM(a())
+----
+====
+\ref DIM MATMAX() MATMIN() MATSUM()
+***/
+void Basic::imat() {
+  mat_view_t dst, src[2];
+  int nsrc = 0;
+  int op = 0;
+  num_t s = 0;
+
+  if (get_mat_operand(dst))
+    return;
+  if (*cip != I_EQ) {
+    E_SYNTAX(I_EQ);
+    return;
+  }
+  ++cip;
+
+  if (is_mat_operand(cip)) {
+    if (get_mat_operand(src[nsrc++]))
+      return;
+    if (*cip == I_PLUS || *cip == I_MUL) {
+      op = *cip++;
+      if (is_mat_operand(cip)) {
+        if (get_mat_operand(src[nsrc++]))
+          return;
+      } else {
+        s = iexp();
+      }
+    }
+  } else {
+    s = iexp();
+  }
+  if (err)
+    return;
+
+  unsigned int n = dst.count;
+  for (int i = 0; i < nsrc; ++i)
+    n = src[i].count < n ? src[i].count : n;
+  if (*cip == I_COMMA) {
+    ++cip;
+    int32_t count;
+    if (getParam(count, 0, n, I_NONE))
+      return;
+    n = count;
+  }
+
+  void *tmp[2] = { NULL, NULL };
+  for (int i = 0; i < nsrc; ++i) {
+    if (mat_unalias(dst, src[i], n, tmp[i]))
+      goto out;
+  }
+
+  if (nsrc == 1 && !op && src[0].type == dst.type) {
+    memmove(dst.data, src[0].data, n * dst.esize);
+    goto out;
+  }
+
+  if (nsrc == 1 && !op) {
+    // plain conversion
+    for (unsigned int i = 0; i < n; ++i)
+      mat_set(dst, i, mat_get(src[0], i));
+    goto out;
+  }
+
+  {
+    const mat_view_t *a = nsrc > 0 ? &src[0] : NULL;
+    const mat_view_t *b = nsrc > 1 ? &src[1] : NULL;
+    bool done = false;
+
+    if ((!a || a->type == dst.type) && (!b || b->type == dst.type)) {
+      switch (dst.type) {
+      case NA_INT8:    done = mat_kernel<int8_t>(dst, a, b, op, s, n); break;
+      case NA_INT16:   done = mat_kernel<int16_t>(dst, a, b, op, s, n); break;
+      case NA_INT32:   done = mat_kernel<int32_t>(dst, a, b, op, s, n); break;
+      case NA_FLOAT32: done = mat_kernel<float>(dst, a, b, op, s, n); break;
+      default:         done = mat_kernel<num_t>(dst, a, b, op, s, n); break;
+      }
+    }
+
+    if (!done) {
+      for (unsigned int i = 0; i < n; ++i) {
+        num_t x = b ? mat_get(*b, i) : s;
+        if (!a)
+          mat_set(dst, i, x);
+        else if (op == I_PLUS)
+          mat_set(dst, i, mat_get(*a, i) + x);
+        else
+          mat_set(dst, i, mat_get(*a, i) * x);
+      }
+    }
+  }
+
+out:
+  free(tmp[0]);
+  free(tmp[1]);
+}
+
+num_t Basic::mat_reduce(int op) {
+  mat_view_t v;
+  if (checkOpen() || get_mat_operand(v))
+    return 0;
+
+  unsigned int n = v.count;
+  if (*cip == I_COMMA) {
+    ++cip;
+    int32_t count;
+    if (getParam(count, 0, n, I_NONE))
+      return 0;
+    n = count;
+  }
+  if (checkClose())
+    return 0;
+
+  if (op != I_MATSUM && !n) {
+    err = ERR_VALUE;
+    return 0;
+  }
+
+  bool want_max = op == I_MATMAX;
+  switch (v.type) {
+#define MAT_REDUCE(E)                                 \
+  if (op == I_MATSUM)                                 \
+    return mat_sum((const E *)v.data, n);             \
+  else                                                \
+    return mat_minmax((const E *)v.data, n, want_max);
+  case NA_INT8:    MAT_REDUCE(int8_t)
+  case NA_INT16:   MAT_REDUCE(int16_t)
+  case NA_INT32:   MAT_REDUCE(int32_t)
+  case NA_FLOAT32: MAT_REDUCE(float)
+  default:         MAT_REDUCE(num_t)
+#undef MAT_REDUCE
+  }
+}
+
+/***bf m MATSUM
+Returns the sum of the elements of an array.
+\usage s = MATSUM(array()[, count])
+\args
+@array	numeric or integer array
+@count	number of elements to add up [default: all]
+\desc
+As with `MAT`, `array(index)` can be used to start at a given element.
+\ret Sum of the elements.
+\ref MAT MATMAX() MATMIN()
+***/
+num_t BASIC_FP Basic::nmatsum() {
+  return mat_reduce(I_MATSUM);
+}
+
+/***bf m MATMIN
+Returns the smallest element of an array.
+\usage m = MATMIN(array()[, count])
+\args
+@array	numeric or integer array
+@count	number of elements to consider [default: all]
+\desc
+As with `MAT`, `array(index)` can be used to start at a given element.
+\ret Value of the smallest element.
+\error
+An error is generated if there are no elements to consider.
+\ref MAT MATMAX() MATSUM()
+***/
+num_t BASIC_FP Basic::nmatmin() {
+  return mat_reduce(I_MATMIN);
+}
+
+/***bf m MATMAX
+Returns the largest element of an array.
+\usage m = MATMAX(array()[, count])
+\args
+@array	numeric or integer array
+@count	number of elements to consider [default: all]
+\desc
+As with `MAT`, `array(index)` can be used to start at a given element.
+\ret Value of the largest element.
+\error
+An error is generated if there are no elements to consider.
+\ref MAT MATMIN() MATSUM()
+***/
+num_t BASIC_FP Basic::nmatmax() {
+  return mat_reduce(I_MATMAX);
+}
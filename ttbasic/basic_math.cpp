@@ -404,7 +404,7 @@ Like most BASIC implementations, Engine BASIC does not have a dedicated
 }
 
 // Numeric expression parser
-num_t BASIC_FP Basic::iexp() {
+num_t BASIC_FP Basic::ior() {
   num_t value, tmp;
 
   value = iand();
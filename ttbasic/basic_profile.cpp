@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2023 Ulrich Hecht
+
+// Sampling profiler
+//
+// While the profiler is enabled, process_events() calls profile_sample()
+// after each statement that raised the attention flag. At most once every
+// PROFILE_INTERVAL_US microseconds the current program line and the chain
+// of procedures that led to it are recorded.
+//
+// Samples are stored as a call tree: each node stands for a procedure or,
+// at the leaves, a program line, and is identified by its parent node and
+// frame. Only leaves carry hit counts; per-line, self and inclusive counts
+// are derived from the tree when the results are listed.
+
+#include <algorithm>
+#include <vector>
+
+#include "basic.h"
+
+#define PROFILE_INTERVAL_US 1000
+#define PROFILE_LIST_LINES  10
+
+// Frames with this bit set are line numbers, all others procedure indices.
+#define PROFILE_LINE 0x80000000U
+#define PROFILE_ROOT 0xffffffffU
+
+uint32_t getlineno(icode_t *lp);
+
+void Basic::profile_reset() {
+  profile_nodes.clear();
+  profile_node_index.clear();
+  profile_samples = 0;
+}
+
+uint32_t Basic::profile_node(uint32_t parent, uint32_t frame) {
+  uint64_t key = ((uint64_t)parent << 32) | frame;
+  auto it = profile_node_index.find(key);
+  if (it != profile_node_index.end())
+    return it->second;
+
+  profile_node_t n = { parent, frame, 0 };
+  profile_nodes.push_back(n);
+  uint32_t idx = profile_nodes.size() - 1;
+  profile_node_index[key] = idx;
+  return idx;
+}
+
+void BASIC_FP Basic::profile_sample() {
+  uint32_t now = micros();
+  if ((int32_t)(now - profile_next_sample) < 0)
+    return;
+  profile_next_sample = now + PROFILE_INTERVAL_US;
+
+  // Statements executed in direct mode are not part of the program.
+  if (clp < listbuf || clp >= listbuf + size_list)
+    return;
+  uint32_t line = getlineno(clp);
+  if (line & PROFILE_LINE)
+    return;
+
+  uint32_t node = PROFILE_ROOT;
+  for (int i = 0; i < gstki; ++i) {
+    if (gstk[i].proc_idx != NO_PROC)
+      node = profile_node(node, gstk[i].proc_idx);
+  }
+  node = profile_node(node, PROFILE_LINE | line);
+
+  profile_nodes[node].hits++;
+  profile_samples++;
+}
+
+struct profile_count_t {
+  uint32_t id;  // line number or procedure index
+  uint32_t self;
+  uint32_t incl;
+};
+
+static bool profile_hotter(const profile_count_t &a,
+                           const profile_count_t &b) {
+  if (a.self != b.self)
+    return a.self > b.self;
+  return a.incl > b.incl;
+}
+
+static uint32_t permille(uint32_t hits, uint32_t total) {
+  return total ? (uint64_t)hits * 1000 / total : 0;
+}
+
+// Prints the hottest program lines and the samples attributed to each
+// procedure, both in the procedure itself (self) and in the procedures it
+// called (inclusive), followed by the cycle counts taken on each call.
+void Basic::profile_list() {
+  std::vector<profile_count_t> lines;
+  std::vector<profile_count_t> pc(procs.size());
+  std::vector<uint32_t> seen;
+
+  for (int i = 0; i < procs.size(); ++i) {
+    pc[i].id = i;
+    pc[i].self = pc[i].incl = 0;
+  }
+
+  for (auto &n : profile_nodes) {
+    if (!n.hits)
+      continue;
+
+    uint32_t line = n.frame & ~PROFILE_LINE;
+    auto l = std::find_if(lines.begin(), lines.end(),
+                          [line](const profile_count_t &c) {
+                            return c.id == line;
+                          });
+    if (l == lines.end()) {
+      profile_count_t c = { line, n.hits, n.hits };
+      lines.push_back(c);
+    } else
+      l->self += n.hits;
+
+    // A recursive procedure appears more than once on the stack, but each
+    // sample counts only once towards its inclusive total.
+    seen.clear();
+    for (uint32_t p = n.parent; p != PROFILE_ROOT; p = profile_nodes[p].parent) {
+      uint32_t proc = profile_nodes[p].frame;
+      if (proc >= pc.size())
+        continue;
+      if (p == n.parent)
+        pc[proc].self += n.hits;
+      if (std::find(seen.begin(), seen.end(), proc) == seen.end()) {
+        seen.push_back(proc);
+        pc[proc].incl += n.hits;
+      }
+    }
+  }
+
+  std::sort(lines.begin(), lines.end(), profile_hotter);
+  std::sort(pc.begin(), pc.end(), profile_hotter);
+
+  sprintf(lbuf, "%u samples", (unsigned int)profile_samples);
+  c_puts(lbuf);
+  newline();
+
+  c_puts("  Line Samples     %");
+  newline();
+  for (int i = 0; i < (int)lines.size() && i < PROFILE_LIST_LINES; ++i) {
+    uint32_t pm = permille(lines[i].self, profile_samples);
+    sprintf(lbuf, "%6u %7u %3u.%u", (unsigned int)lines[i].id,
+            (unsigned int)lines[i].self, (unsigned int)pm / 10,
+            (unsigned int)pm % 10);
+    c_puts(lbuf);
+    newline();
+  }
+
+  c_puts("  Self   Incl     Cycles Proc");
+  newline();
+  for (auto &c : pc) {
+    sprintf(lbuf, "%6u %6u %10u %s", (unsigned int)c.self,
+            (unsigned int)c.incl,
+            (unsigned int)procs.proc(c.id).profile_total,
+            proc_names.name(c.id));
+    c_puts(lbuf);
+    newline();
+  }
+}
+
+// Writes the samples in the "folded stacks" format understood by flame
+// graph tools: one line per distinct stack, frames separated by
+// semicolons, followed by the number of samples.
+void Basic::profile_save(const char *fname) {
+  FILE *f = fopen(fname, "w");
+  if (!f) {
+    err = ERR_FILE_OPEN;
+    return;
+  }
+
+  std::vector<uint32_t> stack;
+  bool ok = true;
+  for (auto &n : profile_nodes) {
+    if (!n.hits)
+      continue;
+
+    stack.clear();
+    for (uint32_t p = n.parent; p != PROFILE_ROOT; p = profile_nodes[p].parent)
+      stack.push_back(profile_nodes[p].frame);
+
+    ok = ok && fputs("main", f) >= 0;
+    for (auto p = stack.rbegin(); ok && p != stack.rend(); ++p) {
+      if ((int)*p < procs.size())
+        ok = fprintf(f, ";%s", proc_names.name(*p)) >= 0;
+    }
+    ok = ok && fprintf(f, ";line %u %u\n",
+                       (unsigned int)(n.frame & ~PROFILE_LINE),
+                       (unsigned int)n.hits) >= 0;
+  }
+
+  if (fclose(f) || !ok)
+    err = ERR_FILE_WRITE;
+}
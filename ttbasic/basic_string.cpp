@@ -5,13 +5,14 @@
 
 BString BASIC_INT Basic::ilrstr(bool right, bool bytewise) {
   BString value;
+  const BString *str = &value;
   num_t nlen;
   int32_t len;
 
   if (checkOpen())
     goto out;
 
-  value = istrexp();
+  str = &istrref(value);
   if (*cip++ != I_COMMA) {
     E_SYNTAX(I_COMMA);
     goto out;
@@ -29,14 +30,14 @@ BString BASIC_INT Basic::ilrstr(bool right, bool bytewise) {
 
   if (bytewise) {
     if (right) {
-      value = value.substring(_max(0, (int)value.length() - len), value.length());
+      value = str->substring(_max(0, (int)str->length() - len), str->length());
     } else
-      value = value.substring(0, len);
+      value = str->substring(0, len);
   } else {
     if (right) {
-      value = value.substringMB(_max(0, (int)value.lengthMB() - len), value.lengthMB());
+      value = str->substringMB(_max(0, (int)str->lengthMB() - len), str->lengthMB());
     } else
-      value = value.substringMB(0, len);
+      value = str->substringMB(0, len);
   }
 
 out:
@@ -120,6 +121,7 @@ implementations.
 ***/
 BString BASIC_INT Basic::smid() {
   BString value;
+  const BString *str = &value;
   num_t nstart;
   int32_t start;
   num_t nlen;
@@ -128,7 +130,7 @@ BString BASIC_INT Basic::smid() {
   if (checkOpen())
     goto out;
 
-  value = istrexp();
+  str = &istrref(value);
   if (*cip++ != I_COMMA) {
     E_SYNTAX(I_COMMA);
     goto out;
@@ -151,12 +153,12 @@ BString BASIC_INT Basic::smid() {
     else
       len = nlen;
   } else {
-    len = value.lengthMB() - start;
+    len = str->lengthMB() - start;
   }
   if (checkClose())
     goto out;
 
-  value = value.substringMB(start, start + len);
+  value = str->substringMB(start, start + len);
 
 out:
   return value;
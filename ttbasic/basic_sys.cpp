@@ -8,6 +8,7 @@
 #include "credits.h"
 #include "eb_video.h"
 #include "eb_sys.h"
+#include "timing.h"
 
 void basic_init_environment() {
 #ifdef __x86_64__
@@ -523,8 +524,10 @@ The following internal information can be retrieved using `SYS()`:
 | `2` | system type; `0` for original (ESP8266), `1` for Shuttle (ESP32),
         `2` for NG (H3 bare-metal), `3` for LT (Linux/SDL-based), `4` for RX
         (Linux/bare-metal hybrid), `5` for Windows, `6` for MacOS.
+| `3` | number of frames that could not be displayed in time since
+        the system was started
 \endtable
-\ref SYS$
+\ref SYS$ TIMING()
 ***/
 num_t Basic::nsys() {
   int32_t item = getparam();
@@ -552,7 +555,64 @@ num_t Basic::nsys() {
 #warning undefined system
                 return -1;
 #endif
-  default:	E_VALUE(0, 2); return 0;
+  case 3:	return timing_missed();
+  default:	E_VALUE(0, 3); return 0;
+  }
+}
+
+/***bf sys TIMING
+Returns timing statistics for a stage of frame processing.
+\usage t = TIMING(stage[, stat])
+\args
+@stage	stage of frame processing [`0` to `9`]
+@stat	statistic to be returned [`0` to `4`, default: `1`]
+\ret Time in microseconds, or number of samples.
+\sec STAGES
+\table
+| `0` | cursor update
+| `1` | BG engine update
+| `2` | sound event processing
+| `3` | `ON PLAY` handlers
+| `4` | `ON SPRITE` handlers
+| `5` | `ON PAD` handlers
+| `6` | composition of text, backgrounds and sprites
+| `7` | transfer of the composed frame to the display
+| `8` | audio rendering
+| `9` | time between two displayed frames
+\endtable
+\sec STATISTICS
+Statistics are computed over the most recent 128 samples of a stage.
+\table
+| `0` | minimum
+| `1` | average
+| `2` | maximum
+| `3` | 99th percentile
+| `4` | total number of samples taken since the system was started
+\endtable
+\note
+Not all stages are measured on all platforms.
+\ref PROFILE SYS()
+***/
+num_t Basic::ntiming() {
+  int32_t stage, stat = 1;
+  if (checkOpen() || getParam(stage, 0, EB_TIMING_STAGES - 1, I_NONE))
+    return 0;
+  if (*cip == I_COMMA) {
+    ++cip;
+    if (getParam(stat, 0, 4, I_NONE))
+      return 0;
+  }
+  if (checkClose())
+    return 0;
+
+  eb_timing_t t;
+  timing_stats(stage, &t);
+  switch (stat) {
+  case 0:	return t.min;
+  case 1:	return t.avg;
+  case 2:	return t.max;
+  case 3:	return t.p99;
+  default:	return t.samples;
   }
 }
 
@@ -770,6 +830,12 @@ void SMALL Basic::isysinfo() {
   putnum(num_lst.size(), 0);
   PRINT_P(" lists\n");
 
+  PRINT_P(" Integer:   ");
+  putnum(int_var.size(), 0);
+  PRINT_P(", ");
+  putnum(int_arr.size(), 0);
+  PRINT_P(" arrays\n");
+
   PRINT_P(" Strings:   ");
   putnum(svar.size(), 0);
   PRINT_P(", ");
@@ -10,6 +10,8 @@ static inline bool is_var(icode_t tok) {
          tok == I_STRARR ||
          tok == I_STRLST ||
          tok == I_NUMLSTREF ||
+         tok == I_IVAR ||
+         tok == I_IVARARR ||
          tok == I_STRLSTREF;
 }
 
@@ -37,6 +39,24 @@ void BASIC_FP Basic::ivar() {
   nvar.var(index) = value;
 }
 
+// Integer variable assignment handler
+void BASIC_FP Basic::iivar() {
+  num_t value;
+  index_t index;
+
+  index = *cip++;
+
+  if (*cip != I_EQ) {
+    err = ERR_VWOEQ;
+    return;
+  }
+  cip++;
+  value = iexp();
+  if (err)
+    return;
+  int_var.var(index) = basic_int(value);
+}
+
 // Local variables are handled by encoding them with global variable indices.
 //
 // When a local variable is created (either through a procedure signature or
@@ -135,26 +155,40 @@ int BASIC_FP Basic::get_array_dims(int *idxs) {
 
 /***bc bas DIM
 Declares an array.
-\usage DIM variable(dimension[, ...]) [= [value, ...]]
+\usage DIM variable(dimension[, ...]) [AS type] [= [value, ...]]
 \args
-@variable	an numeric or string array variable
+@variable	a numeric, integer or string array variable
 @dimension	one or more dimensions of the array
+@type		element type of a numeric array: `BYTE` (8-bit integer), `WORD`
+		(16-bit integer), `LONG` (32-bit integer) or `FLOAT` (single
+		precision) [default: double precision]
 @value		initial value(s) for the array elements
 \note
 Initialization is only possible for one-dimensional arrays.
+
+Arrays with an element type take less memory, and they are faster to
+process with `MAT`. Values assigned to integer elements are truncated, and
+values out of range wrap around.
+
+The type names are only recognized after `AS`, and can be used as
+variable names elsewhere.
+\ref MAT
 ***/
 void Basic::idim() {
   int dims = 0;
   int idxs[MAX_ARRAY_DIMS];
   bool is_string;
+  bool is_int;
+  int type;
   index_t index;
 
   for (;;) {
-    if (*cip != I_VARARR && *cip != I_STRARR) {
+    if (*cip != I_VARARR && *cip != I_STRARR && *cip != I_IVARARR) {
       SYNTAX_T(_("not an array variable"));
       return;
     }
     is_string = *cip == I_STRARR;
+    is_int = *cip == I_IVARARR;
     ++cip;
 
     index = *cip++;
@@ -171,7 +205,27 @@ void Basic::idim() {
     for (int i = 0; i < dims; ++i)
       idxs[i]++;
 
-    if ((!is_string && num_arr.var(index).reserve(dims, idxs)) ||
+    type = NA_NATIVE;
+    if (*cip == I_AS) {
+      if (is_int || is_string) {
+        err = ERR_NOT_SUPPORTED;
+        return;
+      }
+      switch (*++cip) {
+      case I_BYTE:  type = NA_INT8; break;
+      case I_WORD:  type = NA_INT16; break;
+      case I_LONG:  type = NA_INT32; break;
+      case I_FLOAT: type = NA_FLOAT32; break;
+      default:
+        SYNTAX_T(_("expected type"));
+        return;
+      }
+      ++cip;
+    }
+
+    if ((is_int && int_arr.var(index).reserve(dims, idxs)) ||
+        (!is_int && !is_string &&
+         num_arr.var(index).reserve(dims, idxs, type)) ||
         (is_string && str_arr.var(index).reserve(dims, idxs))) {
       err = ERR_OOM;
       return;
@@ -208,10 +262,16 @@ void Basic::idim() {
             value = iexp();
             if (err)
               return;
-            num_t &n = num_arr.var(index).var(1, &cnt);
-            if (err)
-              return;
-            n = value;
+            if (is_int) {
+              int32_t &n = int_arr.var(index).var(1, &cnt);
+              if (err)
+                return;
+              n = basic_int(value);
+            } else {
+              num_arr.var(index).set(1, &cnt, value);
+              if (err)
+                return;
+            }
             cnt++;
           } while (*cip == I_COMMA);
         }
@@ -242,7 +302,8 @@ void BASIC_FP Basic::ivararr() {
   dims = get_array_dims(idxs);
   if (dims < 0)
     return;
-  num_t &n = num_arr.var(index).var(dims, idxs);
+  NumArray<num_t> &arr = num_arr.var(index);
+  int idx = arr.offset(dims, idxs);
   if (err)
     return;
 
@@ -255,7 +316,34 @@ void BASIC_FP Basic::ivararr() {
   value = iexp();  //式の値を取得
   if (err)         //もしエラーが生じたら
     return;        //終了
-  n = value;
+  arr.set(idx, value);
+}
+
+// Integer array variable assignment handler
+void BASIC_FP Basic::iivararr() {
+  num_t value;
+  int idxs[MAX_ARRAY_DIMS];
+  int dims = 0;
+  index_t index;
+
+  index = *cip++;
+
+  dims = get_array_dims(idxs);
+  if (dims < 0)
+    return;
+  int32_t &n = int_arr.var(index).var(dims, idxs);
+  if (err)
+    return;
+
+  if (*cip != I_EQ) {
+    err = ERR_VWOEQ;
+    return;
+  }
+  cip++;
+  value = iexp();
+  if (err)
+    return;
+  n = basic_int(value);
 }
 
 int Basic::get_str_local_offset(index_t arg, bool &is_local) {
@@ -299,8 +387,22 @@ BString &Basic::get_lsvar(index_t arg) {
   }
 }
 
+// Checks if the rest of a string assignment can be appended to the
+// variable directly, i.e. if it neither refers to the variable itself nor
+// calls any procedures that might.
+static bool can_append_in_place(icode_t *ip, icode_t var_tok, index_t index) {
+  for (int next; (next = token_size(ip)) > 0; ip += next) {
+    if (*ip == I_COLON || *ip == I_ELSE || *ip == I_IMPLICITENDIF)
+      break;
+    if (*ip == I_FN || (*ip == var_tok && ip[1] == index))
+      return false;
+  }
+  return true;
+}
+
 void Basic::set_svar(bool is_lsvar) {
   BString value;
+  icode_t var_tok = is_lsvar ? I_LSVAR : I_SVAR;
   index_t index = *cip++;
   int32_t offset;
   uint8_t sval;
@@ -354,6 +456,24 @@ void Basic::set_svar(bool is_lsvar) {
         return;
       }
     }
+  } else if (*cip == var_tok && cip[1] == index && cip[2] == I_PLUS &&
+             can_append_in_place(cip + 2, var_tok, index)) {
+    // a$ = a$ + ...: append to the variable instead of building a copy
+    BString &str = is_lsvar ? get_lsvar(index) : svar.var(index);
+    if (err)
+      return;
+    unsigned int len = str.length();
+    cip += 2;
+    while (*cip == I_PLUS) {
+      ++cip;
+      value = istrvalue();
+      if (err) {
+        str.remove(len);
+        return;
+      }
+      str += value;
+    }
+    return;
   } else {
     value = istrexp();
     if (err)
@@ -364,9 +484,9 @@ void Basic::set_svar(bool is_lsvar) {
     BString &str = get_lsvar(index);
     if (err)
       return;
-    str = value;
+    str = std::move(value);
   } else {
-    svar.var(index) = value;
+    svar.var(index) = std::move(value);
   }
 }
 
@@ -427,7 +547,7 @@ void Basic::istrarr() {
   if (err)
     return;
 
-  s = value;
+  s = std::move(value);
 }
 
 // String list variable assignment handler
@@ -458,7 +578,7 @@ void Basic::istrlst() {
   BString &s = str_lst.var(index).var(idxs[0]);
   if (err)
     return;
-  s = value;
+  s = std::move(value);
 }
 
 // Numeric list variable assignment handler
@@ -541,7 +661,7 @@ void Basic::istrlstref() {
     value = istrexp();
     if (err)
       return;
-    str_lst.var(index).append(value);
+    str_lst.var(index).append(std::move(value));
     if (err)
       return;
   } while (*cip == I_COMMA);
@@ -571,7 +691,7 @@ void Basic::iappend() {
     BString value = istrexp();
     if (err)
       return;
-    str_lst.var(index).append(value);
+    str_lst.var(index).append(std::move(value));
   } else if (*cip == I_NUMLSTREF) {
     index = *++cip;
     if (*++cip != I_COMMA) {
@@ -608,7 +728,7 @@ void Basic::iprepend() {
     BString value = istrexp();
     if (err)
       return;
-    str_lst.var(index).prepend(value);
+    str_lst.var(index).prepend(std::move(value));
   } else if (*cip == I_NUMLSTREF) {
     index = *++cip;
     if (*++cip != I_COMMA) {
@@ -659,6 +779,16 @@ void BASIC_INT NOJUMP Basic::ilet() {
     ivararr();
     break;
 
+  case I_IVAR:
+    cip++;
+    iivar();
+    break;
+
+  case I_IVARARR:
+    cip++;
+    iivararr();
+    break;
+
   case I_SVAR:
     cip++;
     isvar();
@@ -7,24 +7,25 @@
 #include "bgengine.h"
 #include "colorspace.h"
 #include <Arduino.h>
+#include <limits.h>
 
 void BGEngine::enableBg(uint8_t bg) {
-  m_bg_modified = true;
   if (m_bg[bg].tiles) {
     m_bg[bg].enabled = true;
   }
+  damageBg(&m_bg[bg]);
   updateStatus();
 }
 
 void BGEngine::disableBg(uint8_t bg) {
-  m_bg_modified = true;
+  damageBg(&m_bg[bg]);
   m_bg[bg].enabled = false;
   updateStatus();
 }
 
 void BGEngine::freeBg(uint8_t bg_idx) {
   struct bg_t *bg = &m_bg[bg_idx];
-  m_bg_modified = true;
+  damageBg(bg);
   bg->enabled = false;
   if (bg->tiles) {
     free(bg->tiles);
@@ -40,11 +41,12 @@ void BGEngine::freeBg(uint8_t bg_idx) {
 void BGEngine::setBgWin(uint8_t bg_idx, uint32_t x, uint32_t y, uint32_t w,
                         uint32_t h) {
   struct bg_t *bg = &m_bg[bg_idx];
+  damageBg(bg);
   bg->win_x = x;
   bg->win_y = y;
   bg->win_w = w;
   bg->win_h = h;
-  m_bg_modified = true;
+  damageBg(bg);
 }
 
 void BGEngine::mapBgTile(uint8_t bg_idx, uint8_t from, uint8_t to) {
@@ -69,7 +71,7 @@ void BGEngine::setBgTile(uint8_t bg_idx, uint32_t x, uint32_t y, uint8_t t) {
   else
     bg->tiles[toff] = t;
 
-  m_bg_modified = true;
+  damageBgTile(bg, x % bg->w, y % bg->h);
 }
 
 void BGEngine::setBgTiles(uint8_t bg_idx, uint32_t x, uint32_t y,
@@ -82,8 +84,8 @@ void BGEngine::setBgTiles(uint8_t bg_idx, uint32_t x, uint32_t y,
     if (bg->tile_map)
       t = bg->tile_map[t];
     bg->tiles[off + (xx % bg->w)] = t;
+    damageBgTile(bg, xx % bg->w, y % bg->h);
   }
-  m_bg_modified = true;
 }
 
 int GROUP(basic_video) BGEngine::cmp_sprite_y(const void *one,
@@ -166,8 +168,8 @@ void GROUP(basic_video) BGEngine::setSpriteFrame(uint32_t num, uint32_t frame_x,
     s->p.flip_x = flip_x;
     s->p.flip_y = flip_y;
     // XXX: opaque?
+    damageSprite(s);
     s->must_reload = true;
-    m_bg_modified = true;
   }
 }
 
@@ -177,8 +179,8 @@ void BGEngine::setSpriteKey(uint32_t num, ipixel_t key) {
 
   if (s->p.key != pkey) {
     s->p.key = pkey;
+    damageSprite(s);
     s->must_reload = true;
-    m_bg_modified = true;
   }
 }
 
@@ -190,8 +192,8 @@ void GROUP(basic_video) BGEngine::setSpritePattern(uint32_t num, uint32_t pat_x,
     s->p.pat_y = pat_y;
     s->p.frame_x = s->p.frame_y = 0;
 
+    damageSprite(s);
     s->must_reload = true;
-    m_bg_modified = true;
   }
 }
 
@@ -200,7 +202,7 @@ void BGEngine::enableSprite(uint32_t num) {
   if (!s->enabled) {
     s->must_reload = true;
     s->enabled = true;
-    m_bg_modified = true;
+    damageSprite(s);
   }
   updateStatus();
 }
@@ -208,8 +210,8 @@ void BGEngine::enableSprite(uint32_t num) {
 void BGEngine::disableSprite(uint32_t num) {
   struct sprite_t *s = &m_sprite[num];
   if (s->enabled) {
+    damageSprite(s);
     s->enabled = false;
-    m_bg_modified = true;
   }
   updateStatus();
 }
@@ -218,28 +220,29 @@ void GROUP(basic_video) BGEngine::moveSprite(uint32_t num, int32_t x,
                                              int32_t y) {
   sprite_t *s = &m_sprite[num];
   if (s->pos_x != x || s->pos_y != y) {
+    damageSprite(s);
     s->pos_x = x;
     s->pos_y = y;
     qsort(m_sprites_ordered, MAX_SPRITES, sizeof(struct sprite_t *),
           cmp_sprite_y);
-    m_bg_modified = true;
+    damageSprite(s);
   }
 }
 
 void BGEngine::resizeSprite(uint32_t num, uint32_t w, uint32_t h) {
   struct sprite_t *s = &m_sprite[num];
   if (w != s->p.w || h != s->p.h) {
+    damageSprite(s);
     s->p.w = w;
     s->p.h = h;
     s->must_reload = true;
-    m_bg_modified = true;
   }
 }
 
 bool BGEngine::setBgSize(uint8_t bg_idx, uint32_t width, uint32_t height) {
   struct bg_t *bg = &m_bg[bg_idx];
 
-  m_bg_modified = true;
+  damageBg(bg);
   bg->enabled = false;
 
   if (bg->tiles)
@@ -260,7 +263,7 @@ bool BGEngine::setBgSize(uint8_t bg_idx, uint32_t width, uint32_t height) {
 }
 
 void BGEngine::resetSprites() {
-  m_bg_modified = true;
+  damageAll();
   for (int i = 0; i < MAX_SPRITES; ++i) {
     struct sprite_t *s = &m_sprite[i];
     m_sprites_ordered[i] = s;
@@ -291,7 +294,8 @@ void BGEngine::resetSprites() {
 }
 
 void BGEngine::resetBgs() {
-  m_bg_modified = true;
+  damageAll();
+  m_pattern_gen++;
   for (int i = 0; i < MAX_BG; ++i) {
     struct bg_t *bg = &m_bg[i];
     freeBg(i);
@@ -305,7 +309,7 @@ void BGEngine::resetBgs() {
 }
 
 void BGEngine::reset() {
-  m_bg_modified = true;
+  damageAll();
   resetSprites();
   resetBgs();
 
@@ -321,15 +325,212 @@ void BGEngine::lockSprites() {
 void BGEngine::unlockSprites() {
 }
 
+void BGEngine::lockDamage() {
+}
+
+void BGEngine::unlockDamage() {
+}
+
+static inline bool rects_touch(const Rect &a, const Rect &b) {
+  return a.x <= b.x + b.width && b.x <= a.x + a.width &&
+         a.y <= b.y + b.height && b.y <= a.y + a.height;
+}
+
+static inline Rect rects_union(const Rect &a, const Rect &b) {
+  Rect u;
+  u.x = _min(a.x, b.x);
+  u.y = _min(a.y, b.y);
+  u.width = _max(a.x + a.width, b.x + b.width) - u.x;
+  u.height = _max(a.y + a.height, b.y + b.height) - u.y;
+  return u;
+}
+
+void BGEngine::damage(int x, int y, int w, int h) {
+  if (x < 0) {
+    w += x;
+    x = 0;
+  }
+  if (y < 0) {
+    h += y;
+    y = 0;
+  }
+  if (x + w > m_current_mode.x)
+    w = m_current_mode.x - x;
+  if (y + h > m_current_mode.y)
+    h = m_current_mode.y - y;
+  if (w <= 0 || h <= 0)
+    return;
+
+  m_bg_modified = true;
+
+  Rect r = { x, y, w, h };
+
+  lockDamage();
+  if (!m_damage_all) {
+    // Absorb all rectangles the new one overlaps or adjoins.
+    for (int i = 0; i < m_damage_count;) {
+      if (rects_touch(m_damage[i], r)) {
+        r = rects_union(m_damage[i], r);
+        m_damage[i] = m_damage[--m_damage_count];
+        i = 0;
+      } else
+        ++i;
+    }
+
+    if (m_damage_count < MAX_DAMAGE_RECTS)
+      m_damage[m_damage_count++] = r;
+    else {
+      // Out of slots; merge with the rectangle that grows the least.
+      int best = 0;
+      int best_growth = INT_MAX;
+      for (int i = 0; i < m_damage_count; ++i) {
+        Rect u = rects_union(m_damage[i], r);
+        int growth = u.width * u.height -
+                     m_damage[i].width * m_damage[i].height;
+        if (growth < best_growth) {
+          best = i;
+          best_growth = growth;
+        }
+      }
+      m_damage[best] = rects_union(m_damage[best], r);
+    }
+  }
+  unlockDamage();
+}
+
+void BGEngine::damageAll() {
+  m_bg_modified = true;
+  lockDamage();
+  m_damage_all = true;
+  m_damage_count = 0;
+  unlockDamage();
+}
+
+void BGEngine::damageBg(bg_t *bg) {
+  if (bg->enabled)
+    damage(bg->win_x, bg->win_y, bg->win_w, bg->win_h);
+}
+
+// Records the screen areas where tile (tx, ty) of a BG is visible.
+void BGEngine::damageBgTile(bg_t *bg, int tx, int ty) {
+  if (!bg->enabled)
+    return;
+
+  int tsx = bg->tile_size_x;
+  int tsy = bg->tile_size_y;
+  int map_w = bg->w * tsx;
+  int map_h = bg->h * tsy;
+
+  // If the map repeats within the window, it is not worth the trouble.
+  if (map_w < (int)bg->win_w || map_h < (int)bg->win_h) {
+    damageBg(bg);
+    return;
+  }
+
+  // Position of the tile relative to the window, moved to the left and up
+  // to the first repetition that may be visible.
+  int x0 = (tx * tsx - bg->scroll_x) % map_w;
+  int y0 = (ty * tsy - bg->scroll_y) % map_h;
+  if (x0 > 0)
+    x0 -= map_w;
+  if (y0 > 0)
+    y0 -= map_h;
+
+  for (int y = y0; y < (int)bg->win_h; y += map_h) {
+    for (int x = x0; x < (int)bg->win_w; x += map_w) {
+      int dx = x, dy = y, w = tsx, h = tsy;
+      if (dx < 0) {
+        w += dx;
+        dx = 0;
+      }
+      if (dy < 0) {
+        h += dy;
+        dy = 0;
+      }
+      w = _min(w, (int)bg->win_w - dx);
+      h = _min(h, (int)bg->win_h - dy);
+      if (w > 0 && h > 0)
+        damage(bg->win_x + dx, bg->win_y + dy, w, h);
+    }
+  }
+}
+
+// Records the area currently covered by a sprite.
+void BGEngine::damageSprite(sprite_t *s) {
+  if (!s->enabled)
+    return;
+
+  int w = s->p.w;
+  int h = s->p.h;
+#ifdef USE_ROTOZOOM
+  lockSprites();
+  if (s->surf) {
+    w = s->surf->w;
+    h = s->surf->h;
+  }
+  unlockSprites();
+#endif
+  damage(s->pos_x, s->pos_y, w, h);
+}
+
+// Called when the screen mode has changed.
+void BGEngine::resetDamage() {
+  m_text_damage.assign(m_current_mode.y, 0);
+  m_offscreen_damage = false;
+  m_pattern_gen++;
+  damageAll();
+}
+
+// Retrieves the areas that have been damaged since the last call, up to
+// MAX_DAMAGE_RECTS rectangles. Returns the number of rectangles.
+int BGEngine::takeDamage(Rect *rects) {
+  if (m_offscreen_damage) {
+    m_offscreen_damage = false;
+    damageAll();
+  }
+
+  // The line flags are cleared before the caller looks at the text layer,
+  // so writes that happen in the meantime are picked up next time.
+  int lines = m_text_damage.size();
+  for (int y = 0; y < lines;) {
+    if (!m_text_damage[y]) {
+      ++y;
+      continue;
+    }
+    int start = y;
+    while (y < lines && m_text_damage[y])
+      m_text_damage[y++] = 0;
+    damage(0, start, m_current_mode.x, y - start);
+  }
+
+  int count;
+  lockDamage();
+  if (m_damage_all) {
+    Rect all = { 0, 0, m_current_mode.x, m_current_mode.y };
+    rects[0] = all;
+    count = 1;
+  } else {
+    count = m_damage_count;
+    memcpy(rects, m_damage, count * sizeof(Rect));
+  }
+  m_damage_all = false;
+  m_damage_count = 0;
+  unlockDamage();
+
+  return count;
+}
+
 int BGEngine::addBgLayer(eb_layer_painter_t painter, int prio, void *userdata) {
   struct external_layer_t layer = { painter, userdata, prio };
   m_external_layers.push_back(layer);
+  damageAll();
   updateStatus();
   return m_external_layers.size() - 1;
 }
 
 void BGEngine::removeBgLayer(int id) {
   m_external_layers[id].prio = -1;
+  damageAll();
   updateStatus();
 }
 
@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include "rotozoom.h"
 #include "eb_bg.h"
+#include <string.h>
 #include <vector>
 
 #define MAX_BG	16
@@ -19,6 +20,17 @@
 #define MAX_SPRITE_H 1024
 #define MAX_PRIO     (MAX_BG - 1)
 
+#define MAX_DAMAGE_RECTS 16
+
+// Alpha classification of BG tiles and sprite rows. The compositor copies
+// opaque areas and skips transparent ones instead of blending them.
+enum alpha_class_t {
+  ALPHA_UNKNOWN = 0,
+  ALPHA_OPAQUE,
+  ALPHA_TRANSPARENT,
+  ALPHA_MIXED,
+};
+
 class BGEngine : public Video {
 #ifdef USE_BG_ENGINE
 public:
@@ -41,7 +53,8 @@ public:
     struct bg_t *bg = &m_bg[bg_idx];
     bg->tile_size_x = tile_size_x;
     bg->tile_size_y = tile_size_y;
-    m_bg_modified = true;
+    m_pattern_gen++;
+    damageBg(bg);
   }
 
   inline void setBgPattern(uint8_t bg_idx, uint32_t pat_x, uint32_t pat_y,
@@ -50,12 +63,13 @@ public:
     bg->pat_x = pat_x;
     bg->pat_y = pat_y;
     bg->pat_w = pat_w;
-    m_bg_modified = true;
+    m_pattern_gen++;
+    damageBg(bg);
   }
 
   inline void setBgPriority(uint8_t bg_idx, uint8_t prio) {
     m_bg[bg_idx].prio = prio;
-    m_bg_modified = true;
+    damageBg(&m_bg[bg_idx]);
   }
 
   inline uint32_t bgTileSizeX(uint8_t bg) {
@@ -111,7 +125,7 @@ public:
     if (bg->scroll_x != x || bg->scroll_y != y) {
       bg->scroll_x = x;
       bg->scroll_y = y;
-      m_bg_modified = true;
+      damageBg(bg);
     }
   }
 
@@ -170,7 +184,7 @@ public:
 
   inline void setSpritePriority(uint32_t num, uint8_t prio) {
     m_sprite[num].prio = prio;
-    m_bg_modified = true;
+    damageSprite(&m_sprite[num]);
   }
 
 #ifdef USE_ROTOZOOM
@@ -198,15 +212,16 @@ public:
 #endif
 
   inline bool spriteReload(uint32_t num) {
+    // The size of the sprite may change, so the area it covers now has to
+    // be recorded before it is reloaded.
+    damageSprite(&m_sprite[num]);
     m_sprite[num].must_reload = true;
-    if (m_sprite[num].enabled)
-      m_bg_modified = true;
 
     return true;
   }
 
   inline void forceRedraw() {
-    m_bg_modified = true;
+    damageAll();
   }
 
   inline void setFrameskip(uint32_t v) {
@@ -245,8 +260,15 @@ protected:
     bool enabled;
     uint8_t prio;
     uint8_t *tile_map;
+    // alpha class of each tile, valid if tile_class_gen == m_pattern_gen
+    uint8_t tile_class[256];
+    uint32_t tile_class_gen;
   } m_bg[MAX_BG];
 
+  // Changes whenever pattern memory is written or BG patterns are
+  // reconfigured, invalidating the tile classes.
+  volatile uint32_t m_pattern_gen;
+
   struct sprite_props {
     uint32_t pat_x, pat_y;
     uint32_t w, h;
@@ -276,6 +298,7 @@ protected:
     double angle;
     double scale_x, scale_y;
     rz_surface_t *surf;
+    std::vector<uint8_t> row_class;  // alpha class of each row of surf
 #endif
 #ifdef TRUE_COLOR
     uint8_t alpha;
@@ -296,6 +319,57 @@ protected:
   };
 
   std::vector<external_layer_t> m_external_layers;
+
+  inline bool externalLayersActive() {
+    for (auto &l : m_external_layers) {
+      if (l.prio != -1)
+        return true;
+    }
+    return false;
+  }
+
+  // Damage tracking
+  //
+  // Everything that changes the picture records the screen area affected,
+  // and the compositor only rebuilds (and uploads) those areas.
+  // Writes to the text layer mark whole lines in m_text_damage; they are
+  // frequent and may happen one pixel at a time, so this is done without
+  // locking. Everything else is collected in m_damage under lockDamage(),
+  // merging overlapping rectangles.
+  void damage(int x, int y, int w, int h);
+  void damageAll();
+  void damageBg(bg_t *bg);
+  void damageBgTile(bg_t *bg, int tx, int ty);
+  void damageSprite(sprite_t *s);
+
+  inline void damageText(int y, int h) {
+    int lines = m_text_damage.size();
+    // Off-screen memory holds BG and sprite patterns.
+    if (y < 0 || y + h > lines) {
+      m_offscreen_damage = true;
+      m_pattern_gen++;
+    }
+    if (y < 0) {
+      h += y;
+      y = 0;
+    }
+    if (y + h > lines)
+      h = lines - y;
+    if (h > 0)
+      memset(&m_text_damage[y], 1, h);
+  }
+
+  void resetDamage();
+  int takeDamage(Rect *rects);
+
+  virtual void lockDamage();
+  virtual void unlockDamage();
+
+  Rect m_damage[MAX_DAMAGE_RECTS];
+  int m_damage_count;
+  bool m_damage_all;
+  std::vector<uint8_t> m_text_damage;
+  volatile bool m_offscreen_damage;
 #endif
 };
 
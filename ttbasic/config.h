@@ -30,6 +30,9 @@ typedef struct {
   bool record_at_boot;
   BString editor;
   BString audio_device;
+  uint32_t jit_threshold;  // calls before a PROC is compiled, 0: never
+  bool token_cache;        // keep tokenized images of loaded programs
+  uint8_t compose_threads;  // compositor threads, 0: one per core
 } SystemConfig;
 
 extern SystemConfig CONFIG;
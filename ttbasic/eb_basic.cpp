@@ -139,6 +139,42 @@ EBAPI int eb_exec_basic(void *bc, const char *filename) {
     return ((Basic *)bc)->exec(filename);
 }
 
+// Gives direct access to the elements of a dimensioned numeric array, or
+// of an integer array if the name ends in "%". The pointers remain valid
+// until the array is dimensioned again or the variables are cleared.
+EBAPI int eb_get_array(const char *name, eb_array_t *arr) {
+    if (!bc)
+        return -1;
+
+    BString vname(name);
+    bool is_int = vname.endsWith("%");
+    if (is_int)
+        vname = vname.substring(0, vname.length() - 1);
+
+    if (is_int) {
+        int idx = bc->int_arr_names.find(vname.c_str());
+        if (idx < 0 || !bc->int_arr.var(idx).dims())
+            return -1;
+        NumArray<int32_t> &a = bc->int_arr.var(idx);
+        arr->data = a.data();
+        arr->type = EB_ARRAY_INT32;
+        arr->dims = a.dims();
+        arr->sizes = a.sizes();
+        arr->count = a.total();
+    } else {
+        int idx = bc->num_arr_names.find(vname.c_str());
+        if (idx < 0 || !bc->num_arr.var(idx).dims())
+            return -1;
+        NumArray<num_t> &a = bc->num_arr.var(idx);
+        arr->data = a.data();
+        arr->type = a.type();
+        arr->dims = a.dims();
+        arr->sizes = a.sizes();
+        arr->count = a.total();
+    }
+    return 0;
+}
+
 EBAPI void eb_set_error(int error, const char *expected) {
     err = error;
     err_expected = expected;
@@ -18,6 +18,22 @@ typedef struct {
     };
 } eb_param_t;
 
+enum eb_array_type_t {
+    EB_ARRAY_NUM = 0,   // double
+    EB_ARRAY_INT8,
+    EB_ARRAY_INT16,
+    EB_ARRAY_INT32,
+    EB_ARRAY_FLOAT32,
+};
+
+typedef struct {
+    void *data;         // elements, first index changing fastest
+    int type;           // one of eb_array_type_t
+    int dims;
+    const int *sizes;   // number of elements in each dimension
+    unsigned int count; // total number of elements
+} eb_array_t;
+
 typedef double (*eb_numfun_handler_t)(const eb_param_t *params);
 typedef void (*eb_command_handler_t)(const eb_param_t *params);
 typedef const char *(*eb_strfun_handler_t)(const eb_param_t *params);
@@ -33,6 +49,8 @@ int eb_exec_basic(void *bc, const char *filename);
 void *eb_new_basic_context(void);
 void eb_delete_basic_context(void *bc);
 
+int eb_get_array(const char *name, eb_array_t *arr);
+
 void eb_set_error(int error, const char *expected);
 int eb_get_error(void);
 
@@ -7,6 +7,7 @@
 #include "eb_sys.h"
 #include "basic.h"
 #include "basic_native.h"
+#include "timing.h"
 
 EBAPI void eb_wait(unsigned int ms) {
   unsigned end = ms + millis();
@@ -188,3 +189,23 @@ EBAPI const char *eb_module_name(int index) {
   else
     return NULL;
 }
+
+EBAPI int eb_timing(int stage, eb_timing_t *t) {
+  if (check_param(stage, 0, EB_TIMING_STAGES - 1))
+    return -1;
+  return timing_stats(stage, t);
+}
+
+EBAPI unsigned int eb_missed_frames(void) {
+  return timing_missed();
+}
+
+// Starts writing per-frame timing data to a CSV file, replacing any log
+// that is already being written. Stops logging if filename is NULL.
+EBAPI int eb_timing_log(const char *filename) {
+  if (timing_log(filename)) {
+    err = ERR_FILE_OPEN;
+    return -1;
+  }
+  return 0;
+}
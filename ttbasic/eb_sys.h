@@ -1,10 +1,35 @@
 // SPDX-License-Identifier: MIT
 // Copyright (c) 2021 Ulrich Hecht
 
+#ifndef _EB_SYS_H
+#define _EB_SYS_H
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+enum eb_timing_stage_t {
+    EB_TIMING_CURSOR = 0,   // cursor update
+    EB_TIMING_BG,           // BG engine update in process_events()
+    EB_TIMING_SOUND,        // sound event processing
+    EB_TIMING_PLAY,         // ON PLAY handlers
+    EB_TIMING_SPRITE,       // ON SPRITE handlers
+    EB_TIMING_PAD,          // ON PAD handlers
+    EB_TIMING_COMPOSE,      // composition of text, BGs and sprites
+    EB_TIMING_UPLOAD,       // transfer of the composed frame to the display
+    EB_TIMING_AUDIO,        // audio rendering
+    EB_TIMING_FRAME,        // time between two displayed frames
+    EB_TIMING_STAGES
+};
+
+typedef struct {
+    unsigned int min;       // microseconds, over the most recent samples
+    unsigned int avg;
+    unsigned int max;
+    unsigned int p99;
+    unsigned int samples;   // total number of samples recorded
+} eb_timing_t;
+
 void eb_wait(unsigned int ms);
 unsigned int eb_tick(void);
 unsigned int eb_utick(void);
@@ -19,6 +44,12 @@ int eb_load_module(const char *name);
 int eb_module_count(void);
 const char *eb_module_name(int index);
 
+int eb_timing(int stage, eb_timing_t *t);
+unsigned int eb_missed_frames(void);
+int eb_timing_log(const char *filename);
+
 #ifdef __cplusplus
 }
 #endif
+
+#endif
@@ -174,11 +174,14 @@ S(eb_screen)
 S(eb_vsync)
 
 // eb_sys
+S(eb_missed_frames)
 S(eb_process_events)
 S(eb_process_events_check)
 S(eb_process_events_wait)
 S(eb_set_cpu_speed)
 S(eb_tick)
+S(eb_timing)
+S(eb_timing_log)
 S(eb_utick)
 S(eb_wait)
 
@@ -191,6 +194,7 @@ S(eb_kwtbl_size)
 S(eb_new_basic_context)
 S(eb_delete_basic_context)
 S(eb_exec_basic)
+S(eb_get_array)
 S(eb_set_error)
 S(eb_get_error)
 
@@ -43,6 +43,9 @@ struct proc_t {
   unsigned char locc_num, locc_str;
   uint32_t profile_current;
   uint32_t profile_total;
+  uint32_t call_count;
+  void *native;    // compiled code, see basic_jit.cpp
+  bool no_native;  // procedure cannot be compiled
 };
 
 class Procedures {
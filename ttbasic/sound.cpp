@@ -29,6 +29,7 @@
 #include <Arduino.h>
 #include "sound.h"
 #include "audio.h"
+#include "timing.h"
 
 #ifndef AUDIO_SAMPLE_RATE
 #define AUDIO_SAMPLE_RATE 16000
@@ -376,8 +377,10 @@ void GROUP(basic_sound) BasicSound::pumpEvents() {
 void GROUP(basic_sound) BasicSound::render() {
   if (!audio.isBufEmpty() != 0)
     return;
+  uint32_t start = micros();
   sts_mixer_mix_audio(&m_mixer, audio.currBuf(), SOUND_BUFLEN);
   audio.setBufFull();
+  timing_record(EB_TIMING_AUDIO, micros() - start);
 }
 
 void refill_stream_tsf(sts_mixer_sample_t *sample, void *userdata) {
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2023 Ulrich Hecht
+
+// Frame and subsystem timing
+//
+// The duration of each pass through the stages of frame processing (event
+// handling, composition, display upload, audio rendering) is kept in a
+// ring of the last TIMING_WINDOW samples per stage, from which rolling
+// statistics are computed on request. Optionally, the most recent sample
+// of each stage is written to a CSV file once per frame.
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "timing.h"
+
+#define TIMING_WINDOW 128
+
+struct timing_ring_t {
+  uint32_t us[TIMING_WINDOW];
+  uint32_t count;  // total number of samples recorded
+};
+
+static timing_ring_t rings[EB_TIMING_STAGES];
+static volatile uint32_t missed_frames;
+static FILE *log_file;
+
+static const char *stage_names[EB_TIMING_STAGES] = {
+  "cursor", "bg", "sound", "play", "sprite", "pad",
+  "compose", "upload", "audio", "frame",
+};
+
+void timing_record(int stage, uint32_t us) {
+  timing_ring_t &r = rings[stage];
+  r.us[r.count % TIMING_WINDOW] = us;
+  r.count++;
+}
+
+void timing_missed_frames(uint32_t frames) {
+  missed_frames += frames;
+}
+
+uint32_t timing_missed(void) {
+  return missed_frames;
+}
+
+int timing_stats(int stage, eb_timing_t *t) {
+  if (stage < 0 || stage >= EB_TIMING_STAGES)
+    return -1;
+
+  timing_ring_t &r = rings[stage];
+  uint32_t count = r.count;
+  int n = std::min(count, (uint32_t)TIMING_WINDOW);
+
+  uint32_t s[TIMING_WINDOW];
+  memcpy(s, r.us, n * sizeof(s[0]));
+  std::sort(s, s + n);
+
+  uint64_t sum = 0;
+  for (int i = 0; i < n; ++i)
+    sum += s[i];
+
+  t->samples = count;
+  if (!n) {
+    t->min = t->avg = t->max = t->p99 = 0;
+    return 0;
+  }
+  t->min = s[0];
+  t->max = s[n - 1];
+  t->avg = sum / n;
+  t->p99 = s[(n * 99 + 99) / 100 - 1];
+  return 0;
+}
+
+int timing_log(const char *filename) {
+  if (log_file) {
+    fclose(log_file);
+    log_file = NULL;
+  }
+  if (!filename)
+    return 0;
+
+  log_file = fopen(filename, "w");
+  if (!log_file)
+    return -1;
+
+  fputs("frame,missed", log_file);
+  for (int i = 0; i < EB_TIMING_STAGES; ++i)
+    fprintf(log_file, ",%s", stage_names[i]);
+  fputc('\n', log_file);
+  return 0;
+}
+
+void timing_frame_done(uint32_t frame) {
+  if (!log_file)
+    return;
+
+  fprintf(log_file, "%u,%u", (unsigned int)frame,
+          (unsigned int)missed_frames);
+  for (int i = 0; i < EB_TIMING_STAGES; ++i) {
+    timing_ring_t &r = rings[i];
+    uint32_t count = r.count;
+    fprintf(log_file, ",%u",
+            count ? (unsigned int)r.us[(count - 1) % TIMING_WINDOW] : 0);
+  }
+  fputc('\n', log_file);
+}
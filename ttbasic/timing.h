@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2023 Ulrich Hecht
+
+#ifndef _TIMING_H
+#define _TIMING_H
+
+#include <stdint.h>
+#include "eb_sys.h"
+
+// Records the duration of one pass through a stage (one of
+// eb_timing_stage_t) in microseconds. Called from the display and audio
+// threads as well as the interpreter; there is one writer per stage, and
+// readers may see a window that is off by one sample.
+void timing_record(int stage, uint32_t us);
+
+// Records frames that were due but could not be displayed in time.
+void timing_missed_frames(uint32_t frames);
+
+// Called by process_events() once per frame. Writes a line to the timing
+// log if one is open.
+void timing_frame_done(uint32_t frame);
+
+int timing_stats(int stage, eb_timing_t *t);
+uint32_t timing_missed(void);
+int timing_log(const char *filename);
+
+#endif
@@ -79,6 +79,9 @@
 #define DEFAULT_COLORSPACE 0
 #endif
 
+// Upper limit for the number of compositor threads (CONFIG.compose_threads)
+#define MAX_COMPOSE_THREADS 8
+
 // ** Default screen size in terminal mode ************************
 // ※ While moving, can be changed by WIDTH command (default: 80x25)
 // XXX: I don't think this works anymore.
@@ -27,6 +27,9 @@
 
 #include <Arduino.h>
 #include <stdlib.h>
+#include <math.h>
+#include <new>
+#include <utility>
 #include "BString.h"
 #include "error.h"
 #include "kwenum.h"
@@ -40,6 +43,21 @@ typedef int32_t num_t;
 #define strtonum strtol
 #endif
 
+// Conversion of numeric values to integer variables and elements; truncates
+// towards zero and wraps around modulo 2^32. Unlike a plain cast, this is
+// defined for all values, so it gives the same result on all platforms.
+// Infinities and NaN convert to 0.
+static inline int32_t basic_int(num_t x) {
+  if (x > -2147483649.0 && x < 2147483648.0)
+    return (int32_t)x;
+  if (!isfinite(x))
+    return 0;
+  num_t m = fmod(trunc(x), 4294967296.0);
+  if (m < 0)
+    m += 4294967296.0;
+  return (int32_t)(uint32_t)m;
+}
+
 //#define DEBUG_VAR
 #ifdef DEBUG_VAR
 #define dbg_var(x...) \
@@ -54,11 +72,17 @@ typedef int32_t num_t;
 #define varRealloc(p, nu) \
   (__typeof__((p)))realloc((p), nu * sizeof(*(p)));
 
+// Names are looked up through a case-insensitive hash index (open
+// addressing, linear probing) that is kept alongside m_var_name. Names are
+// only ever added at the top and removed by truncation, so the index is
+// simply rebuilt when the table is truncated.
 class VarNames {
 public:
   VarNames() {
     m_var_top = m_prg_var_top = m_size = 0;
     m_var_name = NULL;
+    m_hash = NULL;
+    m_hash_size = 0;
   }
 
   ~VarNames() {
@@ -81,7 +105,10 @@ public:
         m_var_name[i] = NULL;
       }
     }
+    bool shrink = idx < m_var_top;
     m_var_top = idx;
+    if (shrink)
+      rehash(m_hash_size);
   }
 
   void deleteAll() {
@@ -91,6 +118,9 @@ public:
       free(m_var_name);
       m_var_name = NULL;
     }
+    free(m_hash);
+    m_hash = NULL;
+    m_hash_size = 0;
     m_size = m_prg_var_top = m_var_top = 0;
   }
 
@@ -102,6 +132,16 @@ public:
 
   int find(const char *name) {
     dbg_var("vnames find %s\r\n", name);
+    if (m_hash) {
+      unsigned int mask = m_hash_size - 1;
+      for (unsigned int i = hashName(name) & mask;; i = (i + 1) & mask) {
+        int v = m_hash[i];
+        if (v < 0)
+          return -1;
+        if (!strcasecmp(name, m_var_name[v]))
+          return v;
+      }
+    }
     for (index_t i = 0; i < m_var_top; ++i) {
       if (!strcasecmp(name, m_var_name[i])) {
 #ifdef DEBUG_VAR
@@ -134,6 +174,15 @@ public:
     m_var_name[m_var_top++] = strdup(name);
     if (is_prg_text)
       m_prg_var_top = m_var_top;
+    // Keep the index at most half full. The index may be smaller than
+    // that, or missing, if allocating it has failed before.
+    if (m_var_top * 2 > m_hash_size) {
+      unsigned int size = 32;
+      while (size < m_var_top * 2)
+        size *= 2;
+      rehash(size);
+    } else
+      hashInsert(m_var_top - 1);
     dbg_var("got %d\r\n", m_var_top - 1);
     return m_var_top - 1;
   }
@@ -168,10 +217,46 @@ private:
     return false;
   }
 
+  static uint32_t hashName(const char *name) {
+    uint32_t h = 2166136261U;  // FNV-1a
+    while (*name) {
+      h ^= tolower((unsigned char)*name++);
+      h *= 16777619U;
+    }
+    return h;
+  }
+
+  void hashInsert(unsigned int idx) {
+    unsigned int mask = m_hash_size - 1;
+    unsigned int i = hashName(m_var_name[idx]) & mask;
+    while (m_hash[i] >= 0)
+      i = (i + 1) & mask;
+    m_hash[i] = idx;
+  }
+
+  // Rebuilds the index with the given number of slots. If that fails,
+  // find() falls back to searching the names linearly.
+  void rehash(unsigned int size) {
+    if (!size)
+      return;
+    if (size != m_hash_size || !m_hash) {
+      free(m_hash);
+      m_hash = (int *)malloc(size * sizeof(*m_hash));
+      m_hash_size = m_hash ? size : 0;
+    }
+    if (!m_hash)
+      return;
+    memset(m_hash, 0xff, m_hash_size * sizeof(*m_hash));
+    for (unsigned int i = 0; i < m_var_top; ++i)
+      hashInsert(i);
+  }
+
   char **m_var_name;
+  int *m_hash;
+  unsigned int m_hash_size;
 };
 
-class NumVariables {
+template <typename T> class NumVariables {
 public:
   NumVariables() {
     m_size = 0;
@@ -211,13 +296,25 @@ public:
     return m_size;
   }
 
-  inline num_t& var(index_t index) {
+  inline T& var(index_t index) {
     return m_var[index];
   }
 
 private:
   unsigned int m_size;
-  num_t *m_var;
+  T *m_var;
+};
+
+// Element types of numeric arrays. NA_NATIVE is the element type of the
+// array class itself (num_t for numeric arrays, int32_t for integer
+// arrays); the others are packed types selected with DIM ... AS. The
+// values are part of the native module API (see eb_array_t).
+enum num_array_type_t {
+  NA_NATIVE = 0,
+  NA_INT8,
+  NA_INT16,
+  NA_INT32,
+  NA_FLOAT32,
 };
 
 template <typename T> class NumArray {
@@ -225,31 +322,43 @@ public:
   NumArray() {
     m_dims = 0;
     m_sizes = NULL;
-    m_var = NULL;
+    m_data = NULL;
     m_total = 0;
+    m_type = NA_NATIVE;
   }
 
   ~NumArray() {
     if (m_sizes)
       free(m_sizes);
-    if (m_var)
-      free(m_var);
+    if (m_data)
+      free(m_data);
   }
 
   void reset() {
     m_dims = 0;
     m_total = 0;
+    m_type = NA_NATIVE;
     if (m_sizes) {
       free(m_sizes);
       m_sizes = NULL;
     }
-    if (m_var) {
-      free(m_var);
-      m_var = NULL;
+    if (m_data) {
+      free(m_data);
+      m_data = NULL;
     }
   }
 
-  bool reserve(int dims, int *sizes) {
+  static unsigned int elementSize(int type) {
+    switch (type) {
+    case NA_INT8:    return 1;
+    case NA_INT16:   return 2;
+    case NA_INT32:   return 4;
+    case NA_FLOAT32: return 4;
+    default:         return sizeof(T);
+    }
+  }
+
+  bool reserve(int dims, int *sizes, int type = NA_NATIVE) {
     dbg_var("na reserve dims %d\r\n", dims);
     m_sizes = varRealloc(m_sizes, dims);
     m_dims = dims;
@@ -264,55 +373,109 @@ public:
       m_total *= sizes[i];
     }
     dbg_var("na total %d\r\n", m_total);
-    m_var = varRealloc(m_var, m_total);
-    if (!m_var) {
+    m_type = type;
+    m_data = realloc(m_data, m_total * elementSize(type));
+    if (!m_data) {
       free(m_sizes);
       m_dims = 0;
       m_sizes = NULL;
-      m_var = NULL;
+      m_type = NA_NATIVE;
       err = ERR_OOM;
       return true;
     }
-    for (index_t i = 0; i < m_total; ++i) {
-      m_var[i] = 0;
-    }
+    // All-zero bits is 0 for all element types.
+    memset(m_data, 0, m_total * elementSize(type));
     return false;
   }
 
-  inline T& var(int dims, int *idxs) {
+  // Returns the index of the given element in the array storage, or -1
+  // if the indices are invalid.
+  inline int offset(int dims, int *idxs) {
     if (!m_sizes) {
       err = ERR_UNDEFARR;
-      // XXX: Is it possible to return an invalid reference without crashing?
-      return bull;
+      return -1;
     }
     if (dims != m_dims) {
       err = ERR_SOR;
-      // XXX: Likewise.
-      return bull;
+      return -1;
     }
     int mul = 1;
     int idx = 0;
     for (int i = 0; i < m_dims; ++i) {
       if (idxs[i] < 0 || idxs[i] >= m_sizes[i]) {
         err = ERR_SOR;
-        // XXX: Likewise.
-        return bull;
+        return -1;
       }
       idx += idxs[i] * mul;
       mul *= m_sizes[i];
     }
-    return m_var[idx];
+    return idx;
+  }
+
+  // Direct access to elements; only valid for arrays of type NA_NATIVE.
+  inline T& var(int dims, int *idxs) {
+    int idx = offset(dims, idxs);
+    if (idx < 0) {
+      // XXX: Is it possible to return an invalid reference without crashing?
+      return bull;
+    }
+    return ((T *)m_data)[idx];
+  }
+
+  inline T get(int idx) {
+    switch (m_type) {
+    case NA_INT8:    return ((int8_t *)m_data)[idx];
+    case NA_INT16:   return ((int16_t *)m_data)[idx];
+    case NA_INT32:   return ((int32_t *)m_data)[idx];
+    case NA_FLOAT32: return ((float *)m_data)[idx];
+    default:         return ((T *)m_data)[idx];
+    }
+  }
+
+  // Stores a value, converting it to the element type. Integer types
+  // wrap around.
+  inline void set(int idx, T value) {
+    switch (m_type) {
+    case NA_INT8:    ((int8_t *)m_data)[idx] = basic_int(value); break;
+    case NA_INT16:   ((int16_t *)m_data)[idx] = basic_int(value); break;
+    case NA_INT32:   ((int32_t *)m_data)[idx] = basic_int(value); break;
+    case NA_FLOAT32: ((float *)m_data)[idx] = value; break;
+    default:         ((T *)m_data)[idx] = value; break;
+    }
+  }
+
+  inline T get(int dims, int *idxs) {
+    int idx = offset(dims, idxs);
+    return idx < 0 ? 0 : get(idx);
+  }
+  inline void set(int dims, int *idxs, T value) {
+    int idx = offset(dims, idxs);
+    if (idx >= 0)
+      set(idx, value);
   }
 
   inline int dims() {
     return m_dims;
   }
+  inline const int *sizes() {
+    return m_sizes;
+  }
+  inline unsigned int total() {
+    return m_total;
+  }
+  inline int type() {
+    return m_type;
+  }
+  inline void *data() {
+    return m_data;
+  }
 
 private:
   int m_dims;
   unsigned int m_total;
   int *m_sizes;
-  T *m_var;
+  void *m_data;
+  int m_type;
   T bull;
 };
 
@@ -614,62 +777,123 @@ private:
   StringArray<T> **m_var;
 };
 
-#include "QList.h"
-
+// Elements are kept in a ring buffer whose size is a power of two, so
+// that indexing and adding or removing elements at either end take
+// constant time.
 template <typename T> class BasicList {
 public:
   BasicList() {
-    m_list.clear();
+    m_buf = NULL;
+    m_cap = m_head = m_len = 0;
   }
 
   ~BasicList() {
+    reset();
   }
 
   void reset() {
-    m_list.clear();
+    for (unsigned int i = 0; i < m_len; ++i)
+      slot(i).~T();
+    free(m_buf);
+    m_buf = NULL;
+    m_cap = m_head = m_len = 0;
   }
 
   inline T& var(int idx) {
-    if (idx >= m_list.size()) {
+    if ((unsigned int)idx >= m_len) {
       err = ERR_SOR;
       return bull;
     }
-    return m_list.at(idx);
+    return slot(idx);
   }
 
   inline unsigned int size() {
-    return m_list.size();
+    return m_len;
   }
 
   inline void append(T& item) {
-    if (!m_list.push_back(item))
-      err = ERR_OOM;
+    if (m_len == m_cap && grow())
+      return;
+    new (&slot(m_len)) T(item);
+    ++m_len;
+  }
+  inline void append(T&& item) {
+    if (m_len == m_cap && grow())
+      return;
+    new (&slot(m_len)) T(std::move(item));
+    ++m_len;
   }
   inline void prepend(T& item) {
-    if (!m_list.push_front(item))
-      err = ERR_OOM;
+    if (m_len == m_cap && grow())
+      return;
+    m_head = (m_head - 1) & (m_cap - 1);
+    new (&m_buf[m_head]) T(item);
+    ++m_len;
+  }
+  inline void prepend(T&& item) {
+    if (m_len == m_cap && grow())
+      return;
+    m_head = (m_head - 1) & (m_cap - 1);
+    new (&m_buf[m_head]) T(std::move(item));
+    ++m_len;
   }
   inline T front() {
-    if (m_list.size() == 0) {
+    if (m_len == 0) {
       err = ERR_EMPTY;
       return bull;
     } else {
-      return m_list.front();
+      return slot(0);
     }
   }
   inline T back() {
-    if (m_list.size() == 0) {
+    if (m_len == 0) {
       err = ERR_EMPTY;
       return bull;
     } else {
-      return m_list.back();
+      return slot(m_len - 1);
+    }
+  }
+  inline void pop_front() {
+    if (m_len) {
+      slot(0).~T();
+      m_head = (m_head + 1) & (m_cap - 1);
+      --m_len;
     }
   }
-  inline void pop_front() { m_list.pop_front(); }
-  inline void pop_back() { m_list.pop_back(); }
+  inline void pop_back() {
+    if (m_len)
+      slot(--m_len).~T();
+  }
 
 private:
-  QList<T> m_list;
+  inline T& slot(unsigned int idx) {
+    return m_buf[(m_head + idx) & (m_cap - 1)];
+  }
+
+  // Doubles the capacity and moves the elements to the start of the new
+  // buffer.
+  bool grow() {
+    unsigned int cap = m_cap ? m_cap * 2 : 8;
+    T *buf = (T *)malloc(cap * sizeof(T));
+    if (!buf) {
+      err = ERR_OOM;
+      return true;
+    }
+    for (unsigned int i = 0; i < m_len; ++i) {
+      new (&buf[i]) T(std::move(slot(i)));
+      slot(i).~T();
+    }
+    free(m_buf);
+    m_buf = buf;
+    m_cap = cap;
+    m_head = 0;
+    return false;
+  }
+
+  T *m_buf;
+  unsigned int m_cap;
+  unsigned int m_head;
+  unsigned int m_len;
   T bull;
 };
 